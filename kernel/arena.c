@@ -0,0 +1,39 @@
+/*
+ * bump (arena) allocation of loader and debug metadata. all objects of an arena share
+ * its lifetime, so allocation is a pointer increment and freeing is a single reset.
+ */
+
+#include "arena.h"
+#include "util/functions.h"
+
+//
+// make the size bytes at base an empty arena.
+//
+void arena_init(arena *a, void *base, uint64 size) {
+  a->base = (uint64)base;
+  a->size = size;
+  a->top = a->base;
+}
+
+//
+// allocate size bytes (aligned to ARENA_ALIGN). returns NULL if the arena is full.
+//
+void *arena_alloc(arena *a, uint64 size) {
+  uint64 start = ROUNDUP(a->top, ARENA_ALIGN);
+  if (start + size < start || start + size > a->base + a->size) return NULL;
+
+  a->top = start + size;
+  return (void *)start;
+}
+
+//
+// free everything allocated at or after mark, which must point into the arena.
+//
+void arena_release(arena *a, void *mark) {
+  if ((uint64)mark >= a->base && (uint64)mark <= a->top) a->top = (uint64)mark;
+}
+
+//
+// free all objects of the arena at once.
+//
+void arena_reset(arena *a) { a->top = a->base; }
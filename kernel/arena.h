@@ -0,0 +1,22 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "util/types.h"
+
+// a bump allocator over one contiguous region. objects are never freed one by one,
+// the whole arena is released at once (or rolled back to a mark).
+typedef struct arena_t {
+  uint64 base;
+  uint64 size;
+  uint64 top;
+} arena;
+
+// alignment of the objects of an arena
+#define ARENA_ALIGN 8
+
+void arena_init(arena *a, void *base, uint64 size);
+void *arena_alloc(arena *a, uint64 size);
+void arena_release(arena *a, void *mark);
+void arena_reset(arena *a);
+
+#endif
@@ -1,23 +1,63 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-// we use only one HART (cpu) in fundamental experiments
-#define NCPU 1
+// number of HARTs (cpus) the kernel runs on, run spike with -p<NCPU> to use them all.
+// harts beyond NCPU stay parked, and fewer harts work too. more than one hart needs the
+// atomic instructions of the A extension for the spinlocks (spike_interface/atomic.h).
+#define NCPU 4
+#if NCPU > 1 && !defined(__riscv_atomic)
+#error "NCPU > 1 needs the A extension for its spinlocks, build with -march=rv64gc or set NCPU to 1"
+#endif
 
 //interval of timer interrupt. added @lab1_3
 #define TIMER_INTERVAL 1000000
 
 #define DRAM_BASE 0x80000000
 
-/* we use fixed physical (also logical) addresses for the stacks and trap frames as in
- Bare memory-mapping mode */
-// user stack top
-#define USER_STACK 0x81100000
+// the beginning virtual address of PKE kernel, which direct-maps the physical memory
+#define KERN_BASE 0x80000000
+
+// virtual address of the user stack top. user applications are linked below it
+// (cf. user/user.lds), and never reach the direct-mapped kernel addresses.
+#define USER_STACK 0x7ffff000
+
+// the user heap grows from the end of the elf up to USER_MMAP_BASE, and anonymous
+// mappings are placed in [USER_MMAP_BASE, USER_MMAP_END)
+#define USER_MMAP_BASE 0x40000000
+#define USER_MMAP_END 0x70000000
+
+// the user stack grows down from USER_STACK on page fault, up to USER_STACK_LIMIT bytes.
+// the page below the limit is a guard: touching it terminates the process.
+#define USER_STACK_LIMIT (8 << 20)
+#if USER_STACK_LIMIT + 4096 > USER_STACK - USER_MMAP_END
+#error "the user stack and its guard page overlap the mmap area"
+#endif
+// a fault below the stack only grows it if it is at most this many bytes below the
+// lowest stack page or the stack pointer, anything further is a bad access and kills
+// the process (see handle_user_page_fault())
+#define USER_STACK_GAP 4096
+
+// load the segments of the user application on demand: elf_load() only records them,
+// and each page is read from the elf when it is first touched
+#define ELF_DEMAND_PAGING 1
+
+// number of pages following a faulting page of a demand-loaded segment that are read in
+// along with it, 0 disables read-ahead
+#define ELF_READAHEAD_PAGES 4
+
+// print the usage of the kernel object caches (kernel/slab.c) when the application exits
+#define KMEM_STATS 0
+
+// profile the spinlocks (spike_interface/lock_stat.c): acquisitions, spins, hold cycles
+// and the most contended call sites, printed at shutdown and by the lock_stats syscall
+#define LOCK_PROFILE 0
 
-// the stack used by PKE kernel when a syscall happens
-#define USER_KSTACK 0x81200000
+// print the load-balancing statistics of the per-hart run queues (kernel/sched.c) at
+// shutdown
+#define SCHED_STATS 0
 
-// the trap frame used to assemble the user "process"
-#define USER_TRAP_FRAME 0x81300000
+// maximum number of frames printed in the backtrace of a faulting user application,
+// 0 disables backtraces. walking the frames requires code built with frame pointers.
+#define BACKTRACE_DEPTH 16
 
 #endif
@@ -0,0 +1,295 @@
+/*
+ * address-to-source-line lookup over the line table built by place_line_table() in
+ * kernel/elf.c, used to symbolize the pc of a faulting user application.
+ *
+ * the sorted rows are stored compactly: they are cut into blocks of LINE_BLOCK_ROWS
+ * rows, the first row of each block is kept in full in a sparse index, and the other
+ * rows are stored as LEB128 deltas to their predecessor. a lookup binary searches the
+ * index and decodes a single block.
+ *
+ * function names are resolved through an index of the function symbols of the elf,
+ * sorted by address and binary searched in the same way.
+ */
+
+#include "debug_info.h"
+#include "elf.h"
+#include "vmm.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// order rows by address. at equal addresses an end-of-sequence row (line 0) comes
+// first, so that a sequence starting where another one ends wins the lookup.
+static inline int addr_line_less(addr_line *a, addr_line *b) {
+  if (a->addr != b->addr) return a->addr < b->addr;
+  return a->line == 0 && b->line != 0;
+}
+
+static void sift_down(addr_line *line, int root, int n) {
+  for (;;) {
+    int child = 2 * root + 1;
+    if (child >= n) return;
+    if (child + 1 < n && addr_line_less(&line[child], &line[child + 1])) child++;
+    if (!addr_line_less(&line[root], &line[child])) return;
+    addr_line tmp = line[root]; line[root] = line[child]; line[child] = tmp;
+    root = child;
+  }
+}
+
+//
+// sort the line table by address. heapsort is used as it is in-place and O(n log n)
+// even for line programs whose sequences are emitted out of address order.
+//
+void sort_addr_line(addr_line *line, int n) {
+  for (int i = n / 2 - 1; i >= 0; i--) sift_down(line, i, n);
+  for (int i = n - 1; i > 0; i--) {
+    addr_line tmp = line[0]; line[0] = line[i]; line[i] = tmp;
+    sift_down(line, 0, i);
+  }
+}
+
+static char *write_uleb128(char *out, uint64 value) {
+  do {
+    uint8 b = value & 0x7F;
+    value >>= 7;
+    if (value) b |= 0x80;
+    *(out++) = b;
+  } while (value);
+  return out;
+}
+
+static char *write_sleb128(char *out, int64 value) {
+  for (;;) {
+    uint8 b = value & 0x7F;
+    value >>= 7;
+    if ((value == 0 && !(b & 0x40)) || (value == -1 && (b & 0x40))) {
+      *(out++) = b;
+      return out;
+    }
+    *(out++) = b | 0x80;
+  }
+}
+
+static uint64 uleb128_size(uint64 value) {
+  uint64 n = 1;
+  while (value >>= 7) n++;
+  return n;
+}
+
+static uint64 sleb128_size(int64 value) {
+  uint64 n = 1;
+  while (!((value >> 6) == 0 || (value >> 6) == -1)) {
+    value >>= 7;
+    n++;
+  }
+  return n;
+}
+
+//
+// returns the number of bytes encode_line_table() needs for n sorted rows.
+//
+uint64 line_table_size(addr_line *line, int n) {
+  uint64 size = (n + LINE_BLOCK_ROWS - 1) / LINE_BLOCK_ROWS * sizeof(line_block);
+
+  for (int i = 0; i < n; i++) {
+    if (i % LINE_BLOCK_ROWS == 0) continue;
+    size += uleb128_size(line[i].addr - line[i - 1].addr);
+    size += sleb128_size((int64)line[i].line - (int64)line[i - 1].line);
+    size += sleb128_size((int64)line[i].file - (int64)line[i - 1].file);
+  }
+  return size;
+}
+
+//
+// encode n sorted rows into buf (index first, then the delta-encoded rows) and
+// describe the result in t. returns the number of bytes used in buf.
+//
+uint64 encode_line_table(line_table *t, addr_line *line, int n, char *buf) {
+  t->base = buf;
+  t->nrows = n;
+  t->nblocks = (n + LINE_BLOCK_ROWS - 1) / LINE_BLOCK_ROWS;
+
+  line_block *index = (line_block *)buf;
+  char *data = buf + t->nblocks * sizeof(line_block);
+  char *out = data;
+
+  for (int i = 0; i < n; i++) {
+    if (i % LINE_BLOCK_ROWS == 0) {
+      line_block *blk = &index[i / LINE_BLOCK_ROWS];
+      blk->addr = line[i].addr;
+      blk->line = line[i].line;
+      blk->file = line[i].file;
+      blk->off = out - data;
+      continue;
+    }
+    out = write_uleb128(out, line[i].addr - line[i - 1].addr);
+    out = write_sleb128(out, (int64)line[i].line - (int64)line[i - 1].line);
+    out = write_sleb128(out, (int64)line[i].file - (int64)line[i - 1].file);
+  }
+
+  return out - buf;
+}
+
+//
+// find the row covering addr, i.e., the last row whose address is not above addr.
+// returns 0 if addr is before the first row or falls past the end of a sequence,
+// otherwise stores the row in *out and returns 1. the first lookup decodes .debug_line.
+//
+int lookup_addr_line(process *p, uint64 addr, addr_line *out) {
+  if (!elf_load_debug_line(p)) return 0;
+
+  line_table *t = &p->lines;
+  line_block *index = (line_block *)t->base;
+  int lo = 0, hi = t->nblocks;
+
+  // the covering row is in the last block starting at or below addr
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (index[mid].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0) return 0;
+
+  int blk = lo - 1;
+  int rows = MIN(LINE_BLOCK_ROWS, t->nrows - blk * LINE_BLOCK_ROWS);
+  char *off = t->base + t->nblocks * sizeof(line_block) + index[blk].off;
+  addr_line row = {index[blk].addr, index[blk].line, index[blk].file};
+
+  for (int i = 1; i < rows; i++) {
+    uint64 addr_delta;
+    int64 line_delta, file_delta;
+    read_uleb128(&addr_delta, &off);
+    if (row.addr + addr_delta > addr) break;
+    read_sleb128(&line_delta, &off);
+    read_sleb128(&file_delta, &off);
+    row.addr += addr_delta;
+    row.line += line_delta;
+    row.file += file_delta;
+  }
+
+  if (row.line == 0) return 0;
+  *out = row;
+  return 1;
+}
+
+static void sift_down_syms(func_sym *syms, int root, int n) {
+  for (;;) {
+    int child = 2 * root + 1;
+    if (child >= n) return;
+    if (child + 1 < n && syms[child].start < syms[child + 1].start) child++;
+    if (syms[root].start >= syms[child].start) return;
+    func_sym tmp = syms[root]; syms[root] = syms[child]; syms[child] = tmp;
+    root = child;
+  }
+}
+
+//
+// sort function symbols by start address (heapsort, as for the line table).
+//
+void sort_func_syms(func_sym *syms, int n) {
+  for (int i = n / 2 - 1; i >= 0; i--) sift_down_syms(syms, i, n);
+  for (int i = n - 1; i > 0; i--) {
+    func_sym tmp = syms[0]; syms[0] = syms[i]; syms[i] = tmp;
+    sift_down_syms(syms, 0, i);
+  }
+}
+
+//
+// find the function containing addr. returns its name and stores the offset of addr
+// into the function in *offset, or returns NULL if no function symbol covers addr.
+// the first lookup builds the symbol index.
+//
+const char *lookup_func_sym(process *p, uint64 addr, uint64 *offset) {
+  if (!elf_load_symtab(p)) return NULL;
+
+  sym_table *t = &p->syms;
+  int lo = 0, hi = t->nsyms;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (t->syms[mid].start <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0) return NULL;
+
+  func_sym *sym = &t->syms[lo - 1];
+  if (sym->size && addr >= sym->start + sym->size) return NULL;
+  if (offset) *offset = addr - sym->start;
+  return t->names + sym->name;
+}
+
+//
+// read a word of the user stack of p. the frame record must lie in its stack region, a
+// corrupted frame pointer into the heap or a mapping is not followed.
+//
+static int read_user_stack(process *p, uint64 va, uint64 *out) {
+  if (va & 7) return 0;
+  vm_area *vma = find_vma(p, va);
+  if (!vma || vma->type != VMA_STACK) return 0;
+  // read through the physical address, which is valid in M-mode and in the kernel direct map
+  uint64 *pa = (uint64 *)user_va_to_pa(p->pagetable, (void *)va);
+  if (!pa) return 0;
+  *out = *pa;
+  return 1;
+}
+
+//
+// print one frame of a backtrace. it is symbolized at sym_pc through the symbol index
+// and line table.
+//
+static void print_frame(process *p, int depth, uint64 pc, uint64 sym_pc) {
+  uint64 off;
+  addr_line line;
+  const char *func = lookup_func_sym(p, sym_pc, &off);
+
+  if (!func) func = "??";
+  if (lookup_addr_line(p, sym_pc, &line))
+    sprint("  #%d %p in %s() at %s/%s:%ld\n", depth, pc, func, p->dir[p->file[line.file].dir],
+           p->file[line.file].file, line.line);
+  else
+    sprint("  #%d %p in %s()\n", depth, pc, func);
+}
+
+//
+// whether pc may be a return address in p: it lies in an executable user page.
+//
+static int is_user_text(process *p, uint64 pc) {
+  if (pc >= MAXVA) return 0;
+  pte_t *pte = page_walk(p->pagetable, pc, 0);
+  return pte && (*pte & (PTE_V | PTE_U | PTE_X)) == (PTE_V | PTE_U | PTE_X);
+}
+
+//
+// walk the frame pointer chain of a faulting user application, starting at its pc, return
+// address register (ra) and frame pointer (s0). with frame pointers, a frame record holds
+// the return address at fp - 8 and the caller's frame pointer at fp - 16. a leaf function
+// does not save ra, its record only holds the caller's frame pointer at fp - 8, and its
+// caller is in ra. the walk stops after BACKTRACE_DEPTH frames, at a return address out
+// of the code, or at a frame record that is not strictly above the previous one on the
+// user stack.
+//
+void print_user_backtrace(process *p, uint64 pc, uint64 ra_reg, uint64 fp) {
+  if (BACKTRACE_DEPTH <= 0) return;
+
+  sprint("Backtrace:\n");
+  print_frame(p, 0, pc, pc);
+  for (int depth = 1; depth < BACKTRACE_DEPTH; depth++) {
+    uint64 ra, prev_fp;
+    if (!read_user_stack(p, fp - 8, &ra)) break;
+    if (depth == 1 && !is_user_text(p, ra)) {
+      // the faulting function is a leaf: fp - 8 is the frame pointer of its caller
+      prev_fp = ra;
+      ra = ra_reg;
+    } else if (!read_user_stack(p, fp - 16, &prev_fp)) {
+      break;
+    }
+    if (!is_user_text(p, ra)) break;
+
+    // symbolize the call instruction rather than the one after it
+    print_frame(p, depth, ra, ra - 1);
+    if (prev_fp <= fp) break;
+    fp = prev_fp;
+  }
+}
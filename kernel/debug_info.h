@@ -0,0 +1,14 @@
+#ifndef _DEBUG_INFO_H_
+#define _DEBUG_INFO_H_
+
+#include "process.h"
+
+void sort_addr_line(addr_line *line, int n);
+uint64 line_table_size(addr_line *line, int n);
+uint64 encode_line_table(line_table *t, addr_line *line, int n, char *buf);
+int lookup_addr_line(process *p, uint64 addr, addr_line *out);
+void sort_func_syms(func_sym *syms, int n);
+const char *lookup_func_sym(process *p, uint64 addr, uint64 *offset);
+void print_user_backtrace(process *p, uint64 pc, uint64 ra, uint64 fp);
+
+#endif
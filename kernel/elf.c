@@ -4,21 +4,83 @@
  */
 
 #include "elf.h"
-#include "string.h"
+#include "util/string.h"
 #include "riscv.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "util/functions.h"
+#include "debug_info.h"
 #include "spike_interface/spike_utils.h"
 
 typedef struct elf_info_t {
   spike_file_t *f;
   process *p;
+  // the header tables of the elf, only kept while it is loaded
+  arena meta;
 } elf_info;
 
 //
-// the implementation of allocater. allocates memory space for later segment loading
+// the protection of a segment with program header flags flags.
 //
-static void *elf_alloc_mb(elf_ctx *ctx, uint64 elf_pa, uint64 elf_va, uint64 size) {
-  // directly returns the virtual address as we are in the Bare mode in lab1_x
-  return (void *)elf_va;
+static int elf_seg_prot(uint32 flags) {
+  int prot = PROT_NONE;
+  if (flags & ELF_PROG_FLAG_READ) prot |= PROT_READ;
+  if (flags & ELF_PROG_FLAG_WRITE) prot |= PROT_WRITE;
+  if (flags & ELF_PROG_FLAG_EXEC) prot |= PROT_EXEC;
+  return prot;
+}
+
+//
+// the implementation of allocater. allocates memory space for later segment loading,
+// mapped with protection prot.
+//
+static void *elf_alloc_mb(elf_ctx *ctx, uint64 elf_pa, uint64 elf_va, uint64 size, int prot) {
+  pagetable_t pt = ((elf_info *)ctx->info)->p->pagetable;
+  uint64 first = ROUNDDOWN(elf_va, PGSIZE), last = ROUNDUP(elf_va + size, PGSIZE);
+
+  // the first page may be shared with the previous segment, and is mapped already. it
+  // gets the permissions of both segments.
+  pte_t *pte = page_walk(pt, first, 0);
+  if (pte && (*pte & PTE_V)) {
+    *pte |= prot_to_type(prot, 1);
+    first += PGSIZE;
+  }
+  if (first < last) {
+    // the remaining pages of the segment are taken as one physically contiguous run if
+    // there is one, so that the loader reads it with few preads. else page by page.
+    char *pa = alloc_pages_exact((last - first) / PGSIZE);
+    for (uint64 va = first; va < last; va += PGSIZE) {
+      char *page = pa ? pa + (va - first) : alloc_page();
+      if (!page) return NULL;
+      // the loader fills the segment itself, only the bytes of the fresh pages around it
+      // are cleared here
+      uint64 lo = MAX(va, elf_va), hi = MIN(va + PGSIZE, elf_va + size);
+      memzero(page, lo - va);
+      memzero(page + (hi - va), va + PGSIZE - hi);
+      user_vm_map(pt, va, PGSIZE, (uint64)page, prot_to_type(prot, 1));
+    }
+  }
+  return user_va_to_pa(pt, (void *)elf_va);
+}
+
+//
+// returns the physical address of user virtual address va in *pa, and the length of the
+// physically contiguous run starting there, at most n.
+//
+static uint64 elf_user_run(elf_ctx *ctx, uint64 va, uint64 n, char **pa) {
+  pagetable_t pt = ((elf_info *)ctx->info)->p->pagetable;
+  uint64 len = PGSIZE - (va & (PGSIZE - 1));
+
+  *pa = user_va_to_pa(pt, (void *)va);
+  while (len < n && user_va_to_pa(pt, (void *)(va + len)) == *pa + len) len += PGSIZE;
+  return MIN(len, n);
+}
+
+//
+// allocate loader metadata of the elf, freed once the elf is loaded.
+//
+static void *elf_meta_alloc(elf_ctx *ctx, uint64 size) {
+  return arena_alloc(&((elf_info *)ctx->info)->meta, size);
 }
 
 //
@@ -32,6 +94,52 @@ static uint64 elf_fpread(elf_ctx *ctx, void *dest, uint64 nb, uint64 offset) {
   return spike_file_pread(msg->f, dest, nb, offset);
 }
 
+//
+// read the whole program header table and section header table with one pread each,
+// plus the section name string table, so that later lookups need no host round trip.
+//
+static elf_status elf_load_headers(elf_ctx *ctx) {
+  elf_header *eh = &ctx->ehdr;
+  uint64 size;
+
+  if (eh->phnum && eh->phentsize != sizeof(elf_prog_header)) return EL_ERR;
+  if (eh->shnum && eh->shentsize != sizeof(elf_sect_header)) return EL_ERR;
+
+  // the metadata arena is sized for the two tables and the section names, if any, plus
+  // the alignment of the three
+  elf_sect_header names = {0};
+  if (eh->shstrndx < eh->shnum &&
+      elf_fpread(ctx, &names, sizeof(names), eh->shoff + eh->shstrndx * sizeof(names)) !=
+          sizeof(names))
+    return EL_EIO;
+  size = eh->phnum * sizeof(elf_prog_header) + eh->shnum * sizeof(elf_sect_header) +
+         names.size + 1 + 3 * 8;
+  void *meta = alloc_pages(pages_order(ROUNDUP(size, PGSIZE) / PGSIZE));
+  if (!meta) return EL_ENOMEM;
+  arena_init(&((elf_info *)ctx->info)->meta, meta, size);
+
+  size = eh->phnum * sizeof(elf_prog_header);
+  if (!(ctx->phdrs = elf_meta_alloc(ctx, size))) return EL_ENOMEM;
+  if (size && elf_fpread(ctx, ctx->phdrs, size, eh->phoff) != size) return EL_EIO;
+
+  size = eh->shnum * sizeof(elf_sect_header);
+  if (!(ctx->shdrs = elf_meta_alloc(ctx, size))) return EL_ENOMEM;
+  if (size && elf_fpread(ctx, ctx->shdrs, size, eh->shoff) != size) return EL_EIO;
+
+  // section names are only available if the elf keeps its string table
+  ctx->shstrtab = NULL;
+  if (eh->shstrndx < eh->shnum) {
+    elf_sect_header *sh = &ctx->shdrs[eh->shstrndx];
+    char *shstrtab = elf_meta_alloc(ctx, sh->size + 1);
+    if (!shstrtab) return EL_ENOMEM;
+    if (elf_fpread(ctx, shstrtab, sh->size, sh->offset) != sh->size) return EL_EIO;
+    shstrtab[sh->size] = 0;
+    ctx->shstrtab = shstrtab;
+  }
+
+  return EL_OK;
+}
+
 //
 // init elf_ctx, a data structure that loads the elf.
 //
@@ -44,7 +152,21 @@ elf_status elf_init(elf_ctx *ctx, void *info) {
   // check the signature (magic value) of the elf
   if (ctx->ehdr.magic != ELF_MAGIC) return EL_NOTELF;
 
-  return EL_OK;
+  return elf_load_headers(ctx);
+}
+
+//
+// look up a section by its name in the section index built by elf_load_headers().
+// returns NULL if the elf has no such section.
+//
+elf_sect_header *elf_find_section(elf_ctx *ctx, const char *name) {
+  if (!ctx->shstrtab) return NULL;
+
+  uint64 strsize = ctx->shdrs[ctx->ehdr.shstrndx].size;
+  for (int i = 0; i < ctx->ehdr.shnum; i++)
+    if (ctx->shdrs[i].name < strsize && !strcmp(ctx->shstrtab + ctx->shdrs[i].name, name))
+      return &ctx->shdrs[i];
+  return NULL;
 }
 
 // leb128 (little-endian base 128) is a variable-length
@@ -67,7 +189,7 @@ void read_sleb128(int64 *out, char **off) {
         shift += 7;
         if ((b & 0x80) == 0) break;
     }
-    if (shift < 64 && (b & 0x40)) value |= -(1 << shift);
+    if (shift < 64 && (b & 0x40)) value |= -((int64)1 << shift);
     if (out) *out = value;
 }
 // Since reading below types through pointer cast requires aligned address,
@@ -75,72 +197,81 @@ void read_sleb128(int64 *out, char **off) {
 void read_uint64(uint64 *out, char **off) {
     *out = 0;
     for (int i = 0; i < 8; i++) {
-        *out |= (uint64)(**off) << (i << 3); (*off)++;
+        *out |= (uint64)(uint8)(**off) << (i << 3); (*off)++;
     }
 }
 void read_uint32(uint32 *out, char **off) {
     *out = 0;
     for (int i = 0; i < 4; i++) {
-        *out |= (uint32)(**off) << (i << 3); (*off)++;
+        *out |= (uint32)(uint8)(**off) << (i << 3); (*off)++;
     }
 }
 void read_uint16(uint16 *out, char **off) {
     *out = 0;
     for (int i = 0; i < 2; i++) {
-        *out |= (uint16)(**off) << (i << 3); (*off)++;
+        *out |= (uint16)(uint8)(**off) << (i << 3); (*off)++;
     }
 }
 
-/*
-* analyzis the data in the debug_line section
-*
-* the function needs 3 parameters: elf context, data in the debug_line section
-* and length of debug_line section
-*
-* make 3 arrays:
-* "process->dir" stores all directory paths of code files
-* "process->file" stores all code file names of code files and their directory path index of array "dir"
-* "process->line" stores all relationships map instruction addresses to code line numbers
-* and their code file name index of array "file"
-*/
-void make_addr_line(elf_ctx *ctx, char *debug_line, uint64 length) {
-   process *p = ((elf_info *)ctx->info)->p;
-    p->debugline = debug_line;
-    // directory name char pointer array
-    p->dir = (char **)((((uint64)debug_line + length + 7) >> 3) << 3); int dir_ind = 0, dir_base;
-    // file name char pointer array
-    p->file = (code_file *)(p->dir + 64); int file_ind = 0, file_base;
-    // table array
-    p->line = (addr_line *)(p->file + 64); p->line_ind = 0;
+//
+// append a row to the line table (only count it if line is NULL). a row with the same
+// address as its predecessor replaces it.
+//
+static void add_line_row(addr_line *line, int *line_ind, uint64 *last_addr, addr_line *regs,
+                         int file_base) {
+    if (*line_ind > 0 && *last_addr == regs->addr) (*line_ind)--;
+    if (line) {
+        line[*line_ind] = *regs; line[*line_ind].file += file_base - 1;
+    }
+    *last_addr = regs->addr; (*line_ind)++;
+}
+
+//
+// run the line number programs of all compilation units in the debug_line section.
+// dir, file and line receive the directory names, file names and rows; passing NULL
+// arrays only counts them into *ndir, *nfile and *nline.
+//
+static void decode_line_programs(char *debug_line, uint64 length, char **dir, code_file *file,
+                                 addr_line *line, int *ndir, int *nfile, int *nline) {
+    int dir_ind = 0, dir_base, file_ind = 0, file_base, line_ind = 0;
+    uint64 last_addr = 0;
     char *off = debug_line;
     while (off < debug_line + length) { // iterate each compilation unit(CU)
-        debug_header *dh = (debug_header *)off; off += sizeof(debug_header);
+        debug_header *dh = (debug_header *)off;
+        char *cu_end = off + sizeof(dh->length) + dh->length;
+        off += sizeof(debug_header);
         dir_base = dir_ind; file_base = file_ind;
         // get directory name char pointer in this CU
         while (*off != 0) {
-            // sprint("%s\n", off);
-            p->dir[dir_ind++] = off; while (*off != 0) off++; off++;
+            if (dir) dir[dir_ind] = off;
+            dir_ind++;
+            while (*off != 0) off++;
+            off++;
         }
         off++;
         // get file name char pointer in this CU
         while (*off != 0) {
-            p->file[file_ind].file = off; while (*off != 0) off++; off++;
-            uint64 dir; read_uleb128(&dir, &off);
-            p->file[file_ind++].dir = dir - 1 + dir_base;
+            if (file) file[file_ind].file = off;
+            while (*off != 0) off++;
+            off++;
+            uint64 d; read_uleb128(&d, &off);
+            if (file) file[file_ind].dir = d - 1 + dir_base;
+            file_ind++;
             read_uleb128(NULL, &off); read_uleb128(NULL, &off);
         }
         off++; addr_line regs; regs.addr = 0; regs.file = 1; regs.line = 1;
-        // simulate the state machine op code
-        for (;;) {
+        // simulate the state machine op code, a CU may hold several sequences
+        while (off < cu_end) {
             uint8 op = *(off++);
             switch (op) {
                 case 0: // Extended Opcodes
                     read_uleb128(NULL, &off); op = *(off++);
                     switch (op) {
-                        case 1: // DW_LNE_end_sequence
-                            if (p->line_ind > 0 && p->line[p->line_ind - 1].addr == regs.addr) p->line_ind--;
-                            p->line[p->line_ind] = regs; p->line[p->line_ind].file += file_base - 1;
-                            p->line_ind++; goto endop;
+                        case 1: // DW_LNE_end_sequence, recorded as a row with line 0
+                            regs.line = 0;
+                            add_line_row(line, &line_ind, &last_addr, &regs, file_base);
+                            regs.addr = 0; regs.file = 1; regs.line = 1;
+                            break;
                         case 2: // DW_LNE_set_address
                             read_uint64(&regs.addr, &off); break;
                         // ignore DW_LNE_define_file
@@ -149,9 +280,8 @@ void make_addr_line(elf_ctx *ctx, char *debug_line, uint64 length) {
                     }
                     break;
                 case 1: // DW_LNS_copy
-                    if (p->line_ind > 0 && p->line[p->line_ind - 1].addr == regs.addr) p->line_ind--;
-                    p->line[p->line_ind] = regs; p->line[p->line_ind].file += file_base - 1;
-                    p->line_ind++; break;
+                    add_line_row(line, &line_ind, &last_addr, &regs, file_base);
+                    break;
                 case 2: { // DW_LNS_advance_pc
                             uint64 delta; read_uleb128(&delta, &off);
                             regs.addr += delta * dh->min_instruction_length;
@@ -183,68 +313,443 @@ void make_addr_line(elf_ctx *ctx, char *debug_line, uint64 length) {
                              int line_delta = dh->line_base + (adjust % dh->line_range);
                              regs.addr += addr_delta;
                              regs.line += line_delta;
-                             if (p->line_ind > 0 && p->line[p->line_ind - 1].addr == regs.addr) p->line_ind--;
-                             p->line[p->line_ind] = regs; p->line[p->line_ind].file += file_base - 1;
-                             p->line_ind++; break;
+                             add_line_row(line, &line_ind, &last_addr, &regs, file_base);
+                             break;
                          }
             }
         }
-endop:;
+        off = cu_end;
     }
-    // for (int i = 0; i < p->line_ind; i++)
-    //     sprint("%p %d %d\n", p->line[i].addr, p->line[i].line, p->line[i].file);
+    *ndir = dir_ind; *nfile = file_ind; *nline = line_ind;
 }
 
 //
-// load the elf segments to memory regions as we are in Bare mode in lab1
+// load the elf segments to memory regions, and map them in the user page table
 //
 elf_status elf_load(elf_ctx *ctx) {
-  // elf_prog_header structure is defined in kernel/elf.h
-  elf_prog_header ph_addr;
-  int i, off;
+  process *p = ((elf_info *)ctx->info)->p;
+  uint64 seg_end = 0;
+
+  // traverse the elf program segment headers (already read in by elf_init)
+  for (int i = 0; i < ctx->ehdr.phnum; i++) {
+    elf_prog_header *ph_addr = &ctx->phdrs[i];
+
+    if (ph_addr->type != ELF_PROG_LOAD) continue;
+    if (ph_addr->memsz < ph_addr->filesz) return EL_ERR;
+    if (ph_addr->memsz == 0) continue;
+    // user segments must stay below the heap and mmap areas
+    if (ph_addr->vaddr + ph_addr->memsz < ph_addr->vaddr ||
+        ph_addr->vaddr + ph_addr->memsz > USER_MMAP_BASE)
+      return EL_ERR;
+    seg_end = MAX(seg_end, ph_addr->vaddr + ph_addr->memsz);
+
+    // in demand paging mode, the segment is only recorded. its pages are read in by
+    // elf_populate() when first touched.
+    if (ELF_DEMAND_PAGING) {
+      vm_area *vma = add_vma(p, ph_addr->vaddr, ph_addr->vaddr + ph_addr->memsz, VMA_FILE,
+                             elf_seg_prot(ph_addr->flags));
+      if (!vma) return EL_ENOMEM;
+      vma->file_off = ph_addr->off;
+      vma->file_size = ph_addr->filesz;
+      p->elf_file = ((elf_info *)ctx->info)->f;
+
+      sprint("Segment %d at 0x%lx: %ld bytes mapped on demand\n", i, ph_addr->vaddr,
+             ph_addr->memsz);
+      continue;
+    }
+
+    // allocate memory block before elf loading
+    void *dest = elf_alloc_mb(ctx, ph_addr->vaddr, ph_addr->vaddr, ph_addr->memsz,
+                              elf_seg_prot(ph_addr->flags));
+    if (!dest) return EL_ENOMEM;
+
+    // actual loading, one physically contiguous run at a time. only filesz bytes exist
+    // in the file, the rest of the segment (.bss) is zeroed locally rather than
+    // transferred over HTIF.
+    for (uint64 done = 0; done < ph_addr->memsz;) {
+      char *pa;
+      uint64 len = elf_user_run(ctx, ph_addr->vaddr + done, ph_addr->memsz - done, &pa);
+      uint64 nfile = done < ph_addr->filesz ? MIN(len, ph_addr->filesz - done) : 0;
+      if (nfile && elf_fpread(ctx, pa, nfile, ph_addr->off + done) != nfile) return EL_EIO;
+      memzero(pa + nfile, len - nfile);
+      done += len;
+    }
 
-  // traverse the elf program segment headers
-  for (i = 0, off = ctx->ehdr.phoff; i < ctx->ehdr.phnum; i++, off += sizeof(ph_addr)) {
-    // read segment headers
-    if (elf_fpread(ctx, (void *)&ph_addr, sizeof(ph_addr), off) != sizeof(ph_addr)) return EL_EIO;
+    sprint("Segment %d at 0x%lx: %ld bytes loaded, %ld bytes zeroed\n", i, ph_addr->vaddr,
+           ph_addr->filesz, ph_addr->memsz - ph_addr->filesz);
+  }
 
-    if (ph_addr.type != ELF_PROG_LOAD) continue;
-    if (ph_addr.memsz < ph_addr.filesz) return EL_ERR;
-    if (ph_addr.vaddr + ph_addr.memsz < ph_addr.vaddr) return EL_ERR;
+  // the heap starts empty at the first page after the segments
+  uint64 heap = ROUNDUP(seg_end, PGSIZE);
+  if (!add_vma(p, heap, heap, VMA_HEAP, PROT_READ | PROT_WRITE)) return EL_ENOMEM;
+
+  // only record where .debug_line and .symtab are. they are read and decoded by
+  // elf_load_debug_line() and elf_load_symtab() when a fault first needs to be
+  // symbolized, which most runs never do.
+  elf_sect_header *sh = elf_find_section(ctx, ".debug_line");
+  if (sh) {
+    p->debug_file = ((elf_info *)ctx->info)->f;
+    p->debugline_off = sh->offset;
+    p->debugline_size = sh->size;
+    p->debugline_state = DEBUG_PENDING;
+  }
 
-    // allocate memory block before elf loading
-    void *dest = elf_alloc_mb(ctx, ph_addr.vaddr, ph_addr.vaddr, ph_addr.memsz);
+  // the string table of the symbols is the section linked from .symtab
+  sh = elf_find_section(ctx, ".symtab");
+  if (sh && sh->link < ctx->ehdr.shnum && sh->entsize == sizeof(elf_symbol)) {
+    p->debug_file = ((elf_info *)ctx->info)->f;
+    p->symtab_off = sh->offset;
+    p->symtab_size = sh->size;
+    p->strtab_off = ctx->shdrs[sh->link].offset;
+    p->strtab_size = ctx->shdrs[sh->link].size;
+    p->symtab_state = DEBUG_PENDING;
+  }
+
+  return EL_OK;
+}
+
+//
+// close the elf once no debug table is left to be read from it, unless segments are
+// still loaded from it on demand, and the line table sidecar.
+//
+static void elf_put_debug_file(process *p) {
+  if (p->debugline_state == DEBUG_PENDING || p->symtab_state == DEBUG_PENDING) return;
+  if (p->debug_file) {
+    if (p->debug_file != p->elf_file) spike_file_close(p->debug_file);
+    p->debug_file = NULL;
+  }
+  if (p->linetab_file) {
+    spike_file_close(p->linetab_file);
+    p->linetab_file = NULL;
+  }
+}
+
+//
+// the protection of the user page at va, the union of those of the segments sharing it.
+//
+static int elf_page_prot(process *p, uint64 va) {
+  int prot = PROT_NONE;
+  for (int i = 0; i < p->nvmas; i++) {
+    vm_area *v = &p->vmas[i];
+    if (v->type == VMA_FILE && v->start < va + PGSIZE && v->end > va) prot |= v->prot;
+  }
+  return prot;
+}
+
+//
+// fill the page of va in the demand-loaded segment vma of p, together with up to
+// ELF_READAHEAD_PAGES following pages of the segment that are not mapped yet. the run is
+// read with one pread per segment sharing it. returns 0 on success.
+//
+int elf_populate(process *p, vm_area *vma, uint64 va) {
+  uint64 first = ROUNDDOWN(va, PGSIZE), last = first + PGSIZE;
+  uint64 end = ROUNDUP(vma->end, PGSIZE);
+  while (last < end && last - first <= ELF_READAHEAD_PAGES * PGSIZE &&
+         !lookup_pa(p->pagetable, last))
+    last += PGSIZE;
+
+  char *pa = (char *)alloc_pages_exact((last - first) / PGSIZE);
+  if (!pa) return -1;
+
+  // the file bytes of this segment, zeroes around them. the pages at the segment edges
+  // may also hold the file bytes of a neighbouring segment.
+  uint64 lo = MAX(first, vma->start), hi = MIN(last, vma->start + vma->file_size);
+  if (lo >= hi) lo = hi = first;
+  memzero(pa, lo - first);
+  memzero(pa + (hi - first), last - hi);
+  for (int i = 0; i < p->nvmas; i++) {
+    vm_area *v = &p->vmas[i];
+    if (v->type != VMA_FILE) continue;
+    uint64 l = MAX(first, v->start), h = MIN(last, v->start + v->file_size);
+    if (l < h && spike_file_pread(p->elf_file, pa + (l - first), h - l,
+                                  v->file_off + (l - v->start)) != h - l) {
+      for (uint64 off = 0; off < last - first; off += PGSIZE) free_page(pa + off);
+      return -1;
+    }
+  }
 
-    // actual loading
-    if (elf_fpread(ctx, dest, ph_addr.memsz, ph_addr.off) != ph_addr.memsz)
-      return EL_EIO;
+  for (uint64 va = first; va < last; va += PGSIZE)
+    user_vm_map(p->pagetable, va, PGSIZE, (uint64)pa + (va - first),
+                prot_to_type(elf_page_prot(p, va), 1));
+  return 0;
+}
 
-    elf_sect_header elf_sh;
+//
+// the 64-bit FNV-1a hash of n bytes at buf, as computed by tools/gen_linetab.py.
+//
+static uint64 linetab_hash(const char *buf, uint64 n) {
+  uint64 h = 0xcbf29ce484222325UL;
+  for (uint64 i = 0; i < n; i++) h = (h ^ (uint8)buf[i]) * 0x100000001b3UL;
+  return h;
+}
 
-    uint64 off = ctx->ehdr.shoff + ctx->ehdr.shstrndx * sizeof(elf_sh);
-    elf_fpread(ctx, (void *)&elf_sh, sizeof(elf_sh), off);
+//
+// a temporary buffer of size bytes for building the debug tables, to be freed with
+// free_pages(). returns NULL if there is no free block that large.
+//
+static void *debug_tmp_alloc(uint64 size) {
+  return alloc_pages(pages_order(ROUNDUP(MAX(size, 1), PGSIZE) / PGSIZE));
+}
+
+//
+// check a sidecar image of size bytes at buf against the .debug_line section of p, whose
+// hash is hash. returns EL_OK if it can be used as the line table of p.
+//
+static elf_status check_linetab_sidecar(process *p, char *buf, uint64 size, uint64 hash) {
+  linetab_header *h = (linetab_header *)buf;
+
+  if (size < sizeof(linetab_header)) return EL_ERR;
+  if (h->magic != LINETAB_MAGIC || h->version != LINETAB_VERSION) return EL_ERR;
+  // a sidecar left over from an older build of the elf does not match its .debug_line
+  if (h->debugline_size != p->debugline_size || h->debugline_hash != hash) return EL_ERR;
+  if (h->nblocks != (h->nrows + LINE_BLOCK_ROWS - 1) / LINE_BLOCK_ROWS) return EL_ERR;
+  if (size != sizeof(linetab_header) + h->ndir * sizeof(char *) + h->nfile * sizeof(code_file) +
+                  h->table_size + h->strings_size)
+    return EL_ERR;
+
+  char **dir = (char **)(h + 1);
+  code_file *file = (code_file *)(dir + h->ndir);
+  char *strings = (char *)(file + h->nfile) + h->table_size;
+  if (h->strings_size && strings[h->strings_size - 1] != 0) return EL_ERR;
+  for (uint64 i = 0; i < h->ndir; i++)
+    if ((uint64)dir[i] >= h->strings_size) return EL_ERR;
+  for (uint64 i = 0; i < h->nfile; i++)
+    if ((uint64)file[i].file >= h->strings_size) return EL_ERR;
+  return EL_OK;
+}
+
+//
+// point the line table of p into a checked sidecar image at buf, turning the string
+// offsets of the directory and file tables into pointers.
+//
+static void setup_linetab_sidecar(process *p, char *buf) {
+  linetab_header *h = (linetab_header *)buf;
+  char **dir = (char **)(h + 1);
+  code_file *file = (code_file *)(dir + h->ndir);
+  char *table = (char *)(file + h->nfile);
+  char *strings = table + h->table_size;
+
+  for (uint64 i = 0; i < h->ndir; i++) dir[i] = strings + (uint64)dir[i];
+  for (uint64 i = 0; i < h->nfile; i++) file[i].file = strings + (uint64)file[i].file;
+
+  p->debugline = NULL;
+  p->dir = dir;
+  p->file = file;
+  p->lines.base = table;
+  p->lines.nrows = h->nrows;
+  p->lines.nblocks = h->nblocks;
+}
 
-    char elf_shstrtab[elf_sh.size];
+// the line table of a process while it is built in temporary buffers, before it is
+// moved into the debug arena
+typedef struct line_build_t {
+  char *debug_line;     // the .debug_line section
+  char *sidecar;        // a sidecar image matching it, if any
+  uint64 sidecar_size;
+  addr_line *line;      // else the rows run from the line programs, sorted
+  int ndir, nfile, nline;
+  uint64 table_size;    // size of the rows once encoded
+  uint64 size;          // room the line table needs in the arena, 0 if it is unavailable
+} line_build;
 
-    elf_fpread(ctx, elf_shstrtab, elf_sh.size, elf_sh.offset);
+//
+// read the line table sidecar of p (see tools/gen_linetab.py) into b, with a single
+// pread of the whole file. it is kept only if it was generated from the .debug_line
+// section with hash hash.
+//
+static void read_linetab_sidecar(process *p, line_build *b, uint64 hash) {
+  struct stat st;
+  if (spike_file_stat(p->linetab_file, &st) != 0 || !(b->sidecar = debug_tmp_alloc(st.st_size)))
+    return;
+  if (spike_file_pread(p->linetab_file, b->sidecar, st.st_size, 0) == st.st_size &&
+      check_linetab_sidecar(p, b->sidecar, st.st_size, hash) == EL_OK) {
+    b->sidecar_size = st.st_size;
+    return;
+  }
+  free_pages(b->sidecar);
+  b->sidecar = NULL;
+}
 
-    uint64 debug_line_size = 64 * 16;
-    char elf_debug_line[debug_line_size];
+//
+// read the .debug_line section recorded by elf_load(), and get the line table of p ready
+// in b: from the sidecar if it matches, else by running the line programs. sets b->size.
+//
+static void prepare_line_table(process *p, line_build *b) {
+  uint64 length = p->debugline_size;
+  if (!(b->debug_line = debug_tmp_alloc(length)) ||
+      spike_file_pread(p->debug_file, b->debug_line, length, p->debugline_off) != length)
+    return;
+
+  // a line table prebuilt on the host saves running the line programs
+  if (p->linetab_file) read_linetab_sidecar(p, b, linetab_hash(b->debug_line, length));
+  if (b->sidecar) {
+    b->size = b->sidecar_size + ARENA_ALIGN;
+    return;
+  }
 
-    for (int i = 0, off = ctx->ehdr.shoff; i < ctx->ehdr.shnum; i++, off += sizeof(elf_sh))
-    {
-        elf_fpread(ctx, (void *)&elf_sh, sizeof(elf_sh), off) != sizeof(elf_sh);
+  // a first pass only counts the entries, so that the arrays can be sized exactly
+  decode_line_programs(b->debug_line, length, NULL, NULL, NULL, &b->ndir, &b->nfile, &b->nline);
+  if (!(b->line = debug_tmp_alloc(b->nline * sizeof(addr_line)))) return;
+  decode_line_programs(b->debug_line, length, NULL, NULL, b->line, &b->ndir, &b->nfile,
+                       &b->nline);
+  // sequences of different CUs are not necessarily emitted in address order
+  sort_addr_line(b->line, b->nline);
+  // for (int i = 0; i < b->nline; i++)
+  //     sprint("%p %d %d\n", b->line[i].addr, b->line[i].line, b->line[i].file);
+
+  b->table_size = line_table_size(b->line, b->nline);
+  b->size = length + b->ndir * sizeof(char *) + b->nfile * sizeof(code_file) + b->table_size +
+            4 * ARENA_ALIGN;
+}
 
-        if (!strcmp(elf_shstrtab + elf_sh.name, ".debug_line"))
-        {
-            ((elf_info *)ctx->info)->p->debugline = (char *)elf_alloc_mb(ctx, ph_addr.vaddr + ph_addr.memsz, ph_addr.vaddr + ph_addr.memsz, elf_sh.size);
-            elf_fpread(ctx, (void *)((elf_info *)ctx->info)->p->debugline, debug_line_size, elf_sh.offset);
-            make_addr_line(ctx, ((elf_info *)ctx->info)->p->debugline, elf_sh.size);
-        }
+/*
+* move the line table got ready in b into the debug arena of p, which has room for it.
+*
+* a sidecar is copied as is. otherwise 3 arrays are made in the arena:
+* "process->dir" stores all directory paths of code files
+* "process->file" stores all code file names of code files and their directory path index of array "dir"
+* "process->lines" stores all relationships map instruction addresses to code line numbers
+* and their code file name index of array "file", sorted by address and delta encoded
+* (see kernel/debug_info.c). the end of each sequence is kept as a row with line number 0.
+* the names point into a copy of the debug_line section.
+*/
+static void place_line_table(process *p, line_build *b) {
+  arena *a = &p->debug_arena;
+
+  if (b->sidecar) {
+    char *buf = (char *)arena_alloc(a, b->sidecar_size);
+    memcpy(buf, b->sidecar, b->sidecar_size);
+    setup_linetab_sidecar(p, buf);
+    return;
+  }
+
+  p->debugline = (char *)arena_alloc(a, p->debugline_size);
+  memcpy(p->debugline, b->debug_line, p->debugline_size);
+  p->dir = (char **)arena_alloc(a, b->ndir * sizeof(char *));
+  p->file = (code_file *)arena_alloc(a, b->nfile * sizeof(code_file));
+  decode_line_programs(p->debugline, p->debugline_size, p->dir, p->file, NULL, &b->ndir,
+                       &b->nfile, &b->nline);
+  encode_line_table(&p->lines, b->line, b->nline, (char *)arena_alloc(a, b->table_size));
+}
+
+// the function symbol index of a process while it is built in temporary buffers, before
+// it is moved into the debug arena
+typedef struct sym_build_t {
+  elf_symbol *sym;  // the symbol table
+  char *strtab;     // its string table, 0 terminated
+  uint64 nfunc, namesize;
+  uint64 size;      // room the index needs in the arena, 0 if it is unavailable
+} sym_build;
+
+//
+// whether sym, a symbol with names in a string table of strsize bytes, goes into the
+// function symbol index.
+//
+static int is_func_sym(elf_symbol *sym, uint64 strsize) {
+  return ELF_ST_TYPE(sym->info) == ELF_STT_FUNC && sym->shndx && sym->name < strsize;
+}
+
+//
+// read the symbol table recorded by elf_load() and its string table, and count the
+// function symbols of p into b. sets b->size.
+//
+static void prepare_func_syms(process *p, sym_build *b) {
+  if (!(b->sym = debug_tmp_alloc(p->symtab_size)) ||
+      !(b->strtab = debug_tmp_alloc(p->strtab_size + 1)) ||
+      spike_file_pread(p->debug_file, b->sym, p->symtab_size, p->symtab_off) != p->symtab_size ||
+      spike_file_pread(p->debug_file, b->strtab, p->strtab_size, p->strtab_off) != p->strtab_size)
+    return;
+  b->strtab[p->strtab_size] = 0;
+
+  for (uint64 i = 0; i < p->symtab_size / sizeof(elf_symbol); i++) {
+    if (!is_func_sym(&b->sym[i], p->strtab_size)) continue;
+    b->nfunc++;
+    b->namesize += strlen(b->strtab + b->sym[i].name) + 1;
+  }
+  b->size = b->nfunc * sizeof(func_sym) + b->namesize + ARENA_ALIGN;
+}
+
+//
+// build the function symbol index of p in its debug arena, which has room for it: the
+// function symbols counted into b, sorted by address, with their names copied into a
+// compact pool.
+//
+static void place_func_syms(process *p, sym_build *b) {
+  func_sym *syms =
+      (func_sym *)arena_alloc(&p->debug_arena, b->nfunc * sizeof(func_sym) + b->namesize);
+  char *names = (char *)(syms + b->nfunc), *name = names;
+
+  for (uint64 i = 0, j = 0; i < p->symtab_size / sizeof(elf_symbol); i++) {
+    elf_symbol *sym = &b->sym[i];
+    if (!is_func_sym(sym, p->strtab_size)) continue;
+    syms[j].start = sym->value;
+    syms[j].size = sym->size;
+    syms[j].name = name - names;
+    strcpy(name, b->strtab + sym->name);
+    name += strlen(name) + 1;
+    j++;
+  }
+  sort_func_syms(syms, b->nfunc);
+
+  p->syms.syms = syms;
+  p->syms.names = names;
+  p->syms.nsyms = b->nfunc;
+}
+
+//
+// build the pending debug tables of p, its line table and function symbol index, on first
+// use. they are got ready in temporary buffers first, so that the debug arena holding
+// them is sized exactly. a table whose sections cannot be read, or that does not fit in
+// memory, is unavailable.
+//
+static void elf_load_debug_tables(process *p) {
+  line_build lb = {0};
+  sym_build sb = {0};
+
+  if (p->debugline_state == DEBUG_PENDING) prepare_line_table(p, &lb);
+  if (p->symtab_state == DEBUG_PENDING) prepare_func_syms(p, &sb);
+
+  // the tables of a process are only built once, so it has no arena yet
+  uint64 size = lb.size + sb.size;
+  int order = pages_order(ROUNDUP(size, PGSIZE) / PGSIZE);
+  void *base = size ? alloc_pages(order) : NULL;
+  if (base) {
+    // the whole buddy block is the arena
+    arena_init(&p->debug_arena, base, PGSIZE << order);
+    if (lb.size) {
+      place_line_table(p, &lb);
+      p->debugline_state = DEBUG_READY;
+    }
+    if (sb.size) {
+      place_func_syms(p, &sb);
+      p->symtab_state = DEBUG_READY;
     }
   }
+  if (p->debugline_state == DEBUG_PENDING) p->debugline_state = DEBUG_NONE;
+  if (p->symtab_state == DEBUG_PENDING) p->symtab_state = DEBUG_NONE;
 
-  return EL_OK;
+  void *tmp[] = {lb.debug_line, lb.sidecar, lb.line, sb.sym, sb.strtab};
+  for (int i = 0; i < sizeof(tmp) / sizeof(tmp[0]); i++)
+    if (tmp[i]) free_pages(tmp[i]);
+  elf_put_debug_file(p);
+}
+
+//
+// build the line table of p from the .debug_line section recorded by elf_load() on first
+// use. returns 1 if the line table of p is available.
+//
+int elf_load_debug_line(process *p) {
+  if (p->debugline_state == DEBUG_PENDING) elf_load_debug_tables(p);
+  return p->debugline_state == DEBUG_READY;
+}
+
+//
+// build the function symbol index of p from the symbol table recorded by elf_load() on
+// first use. returns 1 if the symbol index of p is available.
+//
+int elf_load_symtab(process *p) {
+  if (p->symtab_state == DEBUG_PENDING) elf_load_debug_tables(p);
+  return p->symtab_state == DEBUG_READY;
 }
 
 typedef union {
@@ -305,11 +810,21 @@ void load_bincode_from_host_elf(process *p) {
   // entry (virtual, also physical in lab1_x) address
   p->trapframe->epc = elfloader.ehdr.entry;
 
+  // the header tables are not needed any more
+  free_pages((void *)info.meta.base);
+
+  // the line table sidecar generated at build time is looked for next to the elf
+  if (p->debugline_state == DEBUG_PENDING) {
+    size_t len = strlen(arg_bug_msg.argv[0]);
+    char path[len + sizeof(LINETAB_SUFFIX)];
+    memcpy(path, arg_bug_msg.argv[0], len);
+    memcpy(path + len, LINETAB_SUFFIX, sizeof(LINETAB_SUFFIX));
+    spike_file_t *f = spike_file_open(path, O_RDONLY, 0);
+    if (!IS_ERR_VALUE(f)) p->linetab_file = f;
+  }
 
-  
-
-  // close the host spike file
-  spike_file_close(info.f);
+  // close the host spike file, unless segments or .debug_line are still to be read from it
+  if (p->elf_file != info.f && p->debug_file != info.f) spike_file_close(info.f);
 
   sprint("Application program entry point (virtual address): 0x%lx\n", p->trapframe->epc);
 }
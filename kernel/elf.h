@@ -51,6 +51,16 @@ typedef struct elf_sect_header_t{
     uint64 entsize;
 } elf_sect_header;
 
+// symbol table entry
+typedef struct elf_symbol_t {
+  uint32 name;   /* Symbol name, index in string table */
+  uint8 info;    /* Type and binding attributes */
+  uint8 other;   /* No defined meaning, 0 */
+  uint16 shndx;  /* Associated section index */
+  uint64 value;  /* Value of the symbol */
+  uint64 size;   /* Associated symbol size */
+} elf_symbol;
+
 // compilation units header (in debug line section)
 typedef struct __attribute__((packed)) {
     uint32 length;
@@ -64,8 +74,33 @@ typedef struct __attribute__((packed)) {
     uint8 std_opcode_lengths[12];
 } debug_header;
 
+// header of the line table sidecar that tools/gen_linetab.py generates next to the elf
+// of the user application. it is followed by the directory table, the file table, the
+// line table in the layout of kernel/debug_info.c, and the string pool.
+typedef struct linetab_header_t {
+  uint32 magic;
+  uint32 version;
+  uint64 debugline_size;  /* size of the .debug_line section it was generated from */
+  uint64 debugline_hash;  /* FNV-1a hash of that .debug_line section */
+  uint64 nrows;
+  uint64 nblocks;
+  uint64 ndir;            /* directories, as offsets into the string pool */
+  uint64 nfile;           /* files, as code_file with the name as offset into the pool */
+  uint64 table_size;      /* size of the sparse index and the delta-encoded rows */
+  uint64 strings_size;
+} linetab_header;
+
+#define LINETAB_MAGIC 0x4c544b50U  // "PKTL" in little endian
+#define LINETAB_VERSION 2
+#define LINETAB_SUFFIX ".lines"
+
 #define ELF_MAGIC 0x464C457FU  // "\x7FELF" in little endian
 #define ELF_PROG_LOAD 1
+#define ELF_PROG_FLAG_EXEC 1
+#define ELF_PROG_FLAG_WRITE 2
+#define ELF_PROG_FLAG_READ 4
+#define ELF_STT_FUNC 2
+#define ELF_ST_TYPE(info) ((info) & 0xf)
 
 typedef enum elf_status_t {
   EL_OK = 0,
@@ -80,10 +115,22 @@ typedef enum elf_status_t {
 typedef struct elf_ctx_t {
   void *info;
   elf_header ehdr;
+
+  // program header table and section index, each read with a single pread
+  elf_prog_header *phdrs;
+  elf_sect_header *shdrs;
+  char *shstrtab;
 } elf_ctx;
 
 elf_status elf_init(elf_ctx *ctx, void *info);
 elf_status elf_load(elf_ctx *ctx);
+elf_sect_header *elf_find_section(elf_ctx *ctx, const char *name);
+int elf_load_debug_line(process *p);
+int elf_load_symtab(process *p);
+int elf_populate(process *p, vm_area *vma, uint64 va);
+
+void read_uleb128(uint64 *out, char **off);
+void read_sleb128(int64 *out, char **off);
 
 void load_bincode_from_host_elf(process *p);
 
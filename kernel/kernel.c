@@ -6,46 +6,94 @@
 #include "string.h"
 #include "elf.h"
 #include "process.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "sched.h"
+#include "config.h"
 
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
 
-// process is a structure defined in kernel/process.h
-process user_app;
+//
+// turn on paging. added @lab2_1
+//
+void enable_paging() {
+  // write the pointer to kernel page (table) directory into the CSR of "satp".
+  write_csr(satp, MAKE_SATP(g_kernel_pagetable));
+
+  // refresh tlb to invalidate its content.
+  flush_tlb();
+}
 
 //
-// load the elf, and construct a "process" (with only a trapframe).
+// load the elf into a process allocated by alloc_process(), and give it a user stack.
 // load_bincode_from_host_elf is defined in elf.c
 //
 void load_user_program(process *proc) {
-  // USER_TRAP_FRAME is a physical address defined in kernel/config.h
-  proc->trapframe = (trapframe *)USER_TRAP_FRAME;
-  memset(proc->trapframe, 0, sizeof(trapframe));
-  // USER_KSTACK is also a physical address defined in kernel/config.h
-  proc->kstack = USER_KSTACK;
+  // USER_STACK is the virtual address of user stack top, defined in kernel/config.h.
+  // the stack starts as one page, populated and grown on page fault.
   proc->trapframe->regs.sp = USER_STACK;
+  if (!add_vma(proc, USER_STACK - PGSIZE, USER_STACK, VMA_STACK, PROT_READ | PROT_WRITE))
+    panic("load_user_program: no region for the user stack.\n");
 
   // load_bincode_from_host_elf() is defined in kernel/elf.c
   load_bincode_from_host_elf(proc);
 }
 
+// set by hart 0 once the kernel page table and the first process are ready, the other
+// harts wait for it
+static volatile int s_init_done = 0;
+
+//
+// S-mode entry point of the harts other than hart 0, which join scheduling once hart 0
+// has set up the kernel.
+//
+static void s_start_secondary(void) {
+  while (!s_init_done)
+    ;
+  write_csr(satp, 0);
+  enable_paging();
+  sprint("hart %ld: kernel page table is on \n", read_tp());
+  schedule();
+}
+
 //
 // s_start: S-mode entry point of riscv-pke OS kernel.
 //
 int s_start(void) {
+  if (read_tp() != 0) s_start_secondary();
+
   sprint("Enter supervisor mode...\n");
-  // Note: we use direct (i.e., Bare mode) for memory mapping in lab1.
-  // which means: Virtual Address = Physical Address
-  // therefore, we need to set satp to be 0 for now. we will enable paging in lab2_x.
-  // 
+  // in the beginning, we use Bare mode (direct) memory mapping as in lab1.
+  // but now, we are going to switch to the paging mode @lab2_1.
+  // note, the code still works in Bare mode when calling pmm_init() and kern_vm_init().
+  //
   // write_csr is a macro defined in kernel/riscv.h
   write_csr(satp, 0);
 
+  // init phisical memory manager. pmm_init() is defined in kernel/pmm.c
+  pmm_init();
+
+  // build the kernel page table. kern_vm_init() is defined in kernel/vmm.c
+  kern_vm_init();
+
+  // now, switch to paging mode by turning on paging (SV39)
+  enable_paging();
+  // the code now formally works in paging mode, meaning the page table is now in use.
+  sprint("kernel page table is on \n");
+
   // the application code (elf) is first loaded into memory, and then put into execution
-  load_user_program(&user_app);
+  // alloc_process() is defined in kernel/process.c
+  process *user_app = alloc_process();
+  if (!user_app) panic("Fail on allocating the user process.\n");
+  load_user_program(user_app);
 
   sprint("Switch to user mode...\n");
-  // switch_to() is defined in kernel/process.c
-  switch_to(&user_app);
+  // insert_to_ready_queue() and schedule() are defined in kernel/sched.c
+  insert_to_ready_queue(user_app);
+  mb();
+  s_init_done = 1;
+  schedule();
 
   // we should never reach here.
   return 0;
@@ -6,16 +6,18 @@
 #include "kernel/riscv.h"
 #include "kernel/config.h"
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
 
 //
 // global variables are placed in the .data section.
 // stack0 is the privilege mode stack(s) of the proxy kernel on CPU(s)
 // allocates 4KB stack space for each processor (hart)
 //
-// NCPU is defined to be 1 in kernel/config.h, as we consider only one HART in basic
-// labs.
+// NCPU is defined in kernel/config.h. after boot, a hart schedules on its stack0 stack
+// (cf. kernel/sched.c), while M-mode traps run on its mstack0 stack.
 //
 __attribute__((aligned(16))) char stack0[4096 * NCPU];
+__attribute__((aligned(16))) char mstack0[4096 * NCPU];
 
 // sstart() is the supervisor state entry point defined in kernel/kernel.c
 extern void s_start();
@@ -27,8 +29,11 @@ extern uint64 htif;
 // g_mem_size is defined in spike_interface/spike_memory.c, size of the emulated memory
 extern uint64 g_mem_size;
 // struct riscv_regs is define in kernel/riscv.h, and g_itrframe is used to save
-// registers when interrupt hapens in M mode. added @lab1_2
-riscv_regs g_itrframe;
+// registers when interrupt hapens in M mode, one per hart. added @lab1_2
+riscv_regs g_itrframe[NCPU];
+
+// set by hart 0 once HTIF and the emulated memory are known, the other harts wait for it
+static volatile int m_init_done = 0;
 
 //
 // get the information of HTIF (calling interface) and the emulated memory by
@@ -91,18 +96,30 @@ void timerinit(uintptr_t hartid) {
 // m_start: machine mode C entry point.
 //
 void m_start(uintptr_t hartid, uintptr_t dtb) {
-  // init the spike file interface (stdin,stdout,stderr)
-  // functions with "spike_" prefix are all defined in codes under spike_interface/,
-  // sprint is also defined in spike_interface/spike_utils.c
-  spike_file_init();
-  sprint("In m_start, hartid:%d\n", hartid);
-
-  // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
-  // init_dtb() is defined above.
-  init_dtb(dtb);
+  // keep the hartid in tp, it identifies lock holders, and indexes the per-hart state of
+  // the S-mode kernel
+  write_tp(hartid);
+
+  if (hartid == 0) {
+    // init the spike file interface (stdin,stdout,stderr)
+    // functions with "spike_" prefix are all defined in codes under spike_interface/,
+    // sprint is also defined in spike_interface/spike_utils.c
+    spike_file_init();
+    sprint("In m_start, hartid:%d\n", hartid);
+
+    // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
+    // init_dtb() is defined above.
+    init_dtb(dtb);
+    mb();
+    m_init_done = 1;
+  } else {
+    while (!m_init_done)
+      ;
+    sprint("In m_start, hartid:%d\n", hartid);
+  }
 
   // save the address of trap frame for interrupt in M mode to "mscratch". added @lab1_2
-  write_csr(mscratch, &g_itrframe);
+  write_csr(mscratch, &g_itrframe[hartid]);
 
   // set previous privilege mode to S (Supervisor), and will enter S mode after 'mret'
   // write_csr is a macro defined in kernel/riscv.h
@@ -127,6 +144,9 @@ void m_start(uintptr_t hartid, uintptr_t dtb) {
   // init timing. added @lab1_3
   timerinit(hartid);
 
+  // let S-mode read the cycle counter, used by the lock profiler (LOCK_PROFILE)
+  write_csr(mcounteren, read_csr(mcounteren) | 1);
+
   // switch to supervisor mode (S mode) and jump to s_start(), i.e., set pc to mepc
   asm volatile("mret");
 }
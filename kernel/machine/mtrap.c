@@ -1,8 +1,13 @@
 #include "kernel/riscv.h"
 #include "kernel/process.h"
+#include "kernel/debug_info.h"
 #include "spike_interface/spike_utils.h"
 #include "util/string.h"
 
+// registers of the interrupted context of each hart, saved by mtrapvec. defined in
+// kernel/machine/minit.c
+extern riscv_regs g_itrframe[NCPU];
+
 static void handle_instruction_access_fault() { panic("Instruction access fault!"); }
 
 static void handle_load_access_fault() { panic("Load access fault!"); }
@@ -17,7 +22,7 @@ static void handle_misaligned_store() { panic("Misaligned AMO!"); }
 
 // added @lab1_3
 static void handle_timer() {
-  int cpuid = 0;
+  int cpuid = read_csr(mhartid);
   // setup the timer fired at next time (TIMER_INTERVAL from now)
   *(uint64*)CLINT_MTIMECMP(cpuid) = *(uint64*)CLINT_MTIMECMP(cpuid) + TIMER_INTERVAL;
 
@@ -25,23 +30,35 @@ static void handle_timer() {
   write_csr(sip, SIP_SSIP);
 }
 
-static void print_exinfo() {
-  int i;
-  addr_line* line = current->line;
-  code_file* file = current->file;
-  char** dir = current->dir;
+// the process that trapped, or NULL if the trap did not come from user mode (e.g. a hart
+// in scheduler(), which runs with no process). tp belongs to the user here, so current
+// does not apply.
+static process *trapped_process() {
+  if ((read_csr(mstatus) & MSTATUS_MPP_MASK) != MSTATUS_MPP_U) return NULL;
+  return cpus[read_csr(mhartid)].proc;
+}
+
+static void print_exinfo(process *p) {
+  code_file* file = p->file;
+  char** dir = p->dir;
   uint64 mepc = read_csr(mepc);
-  // sprint("%x\n",mepc);
-  for(i = 0; i < current->line_ind; i++)
-  {
-    // sprint("%x %s\n", line[i].addr, file[line[i].file].file);
-    if (line[i].addr == mepc) break;
+
+  // the function symbol is available even if the elf carries no .debug_line
+  uint64 func_off;
+  const char *func = lookup_func_sym(p, mepc, &func_off);
+
+  // binary search the sorted line table for the row covering mepc
+  addr_line line;
+  if (!lookup_addr_line(p, mepc, &line)) {
+    if (func)
+      sprint("Runtime error at %p (%s+%ld)\n", mepc, func, func_off);
+    else
+      sprint("Runtime error at %p (no line information)\n", mepc);
+    return;
   }
-  // sprint("%s %s %s\n",dir[0],dir[1],dir[2]);
-  int l = line[i].line;
-  char *filename = file[line[i].file].file;
-  char *dirname = dir[file[line[i].file].dir];
-  // sprint("%d %s\n",i,filename);
+  int l = line.line;
+  char *filename = file[line.file].file;
+  char *dirname = dir[file[line.file].dir];
 
   int len1 = -1;
   while (dirname[++len1])
@@ -67,23 +84,14 @@ static void print_exinfo() {
 
   // strcpy(path+len1+1,filename);
 
-  sprint("Runtime error at %s:%lld\n", path, l);
+  if (func)
+    sprint("Runtime error at %s:%lld in %s()\n", path, l, func);
+  else
+    sprint("Runtime error at %s:%lld\n", path, l);
 
-  spike_file_t *fp = spike_file_open(path, O_RDONLY, 0);
-  i = 0;
-  char c;
-  while(i<l-1) {
-    while(spike_file_read(fp,&c,1)&&c!='\n');
-    i++;
-  }
+  // fetch the source line through the cached, line-indexed reader of the file
   char sen[256];
-  i = 0;
-
-  while (spike_file_read(fp, &c, 1) && c != '\n')
-    sen[i++] = c;
-  spike_file_close(fp);
-  sen[i] = 0;
-  sprint("%s\n",sen);
+  if (spike_file_getline(path, l, sen, sizeof(sen)) >= 0) sprint("%s\n", sen);
 }
 
 //
@@ -91,8 +99,17 @@ static void print_exinfo() {
 //
 void handle_mtrap() {
   uint64 mcause = read_csr(mcause);
-  if(mcause != CAUSE_MTIMER)
-    print_exinfo();
+  if(mcause != CAUSE_MTIMER) {
+    process *p = trapped_process();
+    if (p) {
+      print_exinfo(p);
+      riscv_regs *regs = &g_itrframe[read_csr(mhartid)];
+      print_user_backtrace(p, read_csr(mepc), regs->ra, regs->s0);
+    } else {
+      // no user program to symbolize against
+      sprint("Runtime error in the kernel at %p, mcause %p\n", read_csr(mepc), mcause);
+    }
+  }
   switch (mcause) {
     case CAUSE_MTIMER:
       handle_timer();
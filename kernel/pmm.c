@@ -0,0 +1,262 @@
+/*
+ * physical page frame allocator. manages the memory from the end of PKE kernel (_end in
+ * kernel/kernel.lds) to the end of the emulated DRAM (DRAM_BASE + g_mem_size) with a
+ * buddy system: free memory is kept in blocks of 2^order pages aligned to their size,
+ * one free list per order. allocation splits a larger block when the list of the wanted
+ * order is empty, and freeing coalesces a block with its buddy as long as the buddy is
+ * also free.
+ *
+ * each page has a one-byte descriptor in pg_desc[], placed at the start of free memory.
+ * only the first page of a block carries its order and state, the descriptors of the
+ * other pages of the block stay 0. a block shared by several owners (e.g., a user page
+ * after a copy-on-write fork) is counted in pg_ref[], kept next to pg_desc[].
+ */
+
+#include "pmm.h"
+#include "riscv.h"
+#include "config.h"
+#include "util/functions.h"
+#include "util/string.h"
+#include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
+
+// _end is defined in kernel/kernel.lds, it marks the ending (virtual) address of PKE kernel
+extern char _end[];
+// g_mem_size is defined in spike_interface/spike_memory.c, it indicates the size of our
+// (emulated) spike machine. g_mem_size's value is obtained when initializing HTIF.
+extern uint64 g_mem_size;
+
+static uint64 free_mem_start_addr;  // beginning address of free memory
+static uint64 free_mem_end_addr;    // end address of free memory (not included)
+
+// page descriptors, indexed by page frame number counted from DRAM_BASE
+#define PG_ORDER_MASK 0x3f
+#define PG_ALLOC 0x40  // first page of an allocated block
+#define PG_FREE 0x80   // first page of a free block
+static uint8 *pg_desc;
+// references to allocated blocks, counted on their first page
+static uint16 *pg_ref;
+
+// a free block links itself into the circular list of its order
+typedef struct free_block_t {
+  struct free_block_t *next, *prev;
+} free_block;
+
+static free_block free_area[PMM_MAX_ORDER + 1];
+static uint64 nr_free[PMM_MAX_ORDER + 1];  // free blocks per order
+static uint64 g_free_pages;                // number of free pages
+// guards the free lists, descriptors and reference counts, shared by all harts
+static spinlock_t pmm_lock = SPINLOCK_INIT_NAMED("pmm");
+
+static inline uint64 pa2pfn(uint64 pa) { return (pa - DRAM_BASE) >> PGSHIFT; }
+static inline uint64 pfn2pa(uint64 pfn) { return DRAM_BASE + (pfn << PGSHIFT); }
+
+static void push_block(uint64 pfn, int order) {
+  free_block *b = (free_block *)pfn2pa(pfn), *head = &free_area[order];
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  pg_desc[pfn] = PG_FREE | order;
+  nr_free[order]++;
+}
+
+static void remove_block(uint64 pfn, int order) {
+  free_block *b = (free_block *)pfn2pa(pfn);
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  pg_desc[pfn] = 0;
+  nr_free[order]--;
+}
+
+static void *buddy_alloc(int order) {
+  int k = order;
+
+  if (order < 0 || order > PMM_MAX_ORDER) return NULL;
+  while (k <= PMM_MAX_ORDER && nr_free[k] == 0) k++;
+  if (k > PMM_MAX_ORDER) return NULL;
+
+  uint64 pfn = pa2pfn((uint64)free_area[k].next);
+  remove_block(pfn, k);
+  // give the upper halves back until the block has the wanted size
+  while (k > order) {
+    k--;
+    push_block(pfn + (1UL << k), k);
+  }
+
+  pg_desc[pfn] = PG_ALLOC | order;
+  pg_ref[pfn] = 1;
+  g_free_pages -= 1UL << order;
+  return (void *)pfn2pa(pfn);
+}
+
+static void buddy_free(void *pa) {
+  uint64 pfn = pa2pfn((uint64)pa);
+
+  if (((uint64)pa % PGSIZE) != 0 || (uint64)pa < free_mem_start_addr ||
+      (uint64)pa >= free_mem_end_addr || !(pg_desc[pfn] & PG_ALLOC))
+    panic("free_pages 0x%lx \n", pa);
+
+  int order = pg_desc[pfn] & PG_ORDER_MASK;
+  pg_desc[pfn] = 0;
+  pg_ref[pfn] = 0;
+  g_free_pages += 1UL << order;
+
+  while (order < PMM_MAX_ORDER) {
+    uint64 buddy = pfn ^ (1UL << order);
+    if (pfn2pa(buddy) >= free_mem_end_addr || pg_desc[buddy] != (PG_FREE | order)) break;
+    remove_block(buddy, order);
+    pfn &= ~(1UL << order);
+    order++;
+  }
+  push_block(pfn, order);
+}
+
+//
+// allocates a block of 2^order pages, returns NULL if no block is large enough.
+//
+void *alloc_pages(int order) {
+  spinlock_lock(&pmm_lock);
+  void *pa = buddy_alloc(order);
+  spinlock_unlock(&pmm_lock);
+  return pa;
+}
+
+//
+// returns the block at pa to the free lists, merging it with its free buddies.
+//
+void free_pages(void *pa) {
+  spinlock_lock(&pmm_lock);
+  buddy_free(pa);
+  spinlock_unlock(&pmm_lock);
+}
+
+//
+// allocates npages contiguous pages, returns NULL if there is no such run, or npages is 0.
+// the pages past npages in the underlying block are returned to the free lists, and each
+// of the npages pages is then owned (and freed) on its own.
+//
+void *alloc_pages_exact(uint64 npages) {
+  if (npages == 0) return NULL;
+  int order = pages_order(npages);
+  spinlock_lock(&pmm_lock);
+  uint64 pa = (uint64)buddy_alloc(order);
+  if (pa) {
+    uint64 pfn = pa2pfn(pa);
+    for (uint64 i = 0; i < (1UL << order); i++) {
+      pg_desc[pfn + i] = PG_ALLOC;
+      pg_ref[pfn + i] = 1;
+    }
+    for (uint64 i = npages; i < (1UL << order); i++) buddy_free((void *)pfn2pa(pfn + i));
+  }
+  spinlock_unlock(&pmm_lock);
+  return (void *)pa;
+}
+
+//
+// returns the smallest order whose blocks hold npages pages.
+//
+int pages_order(uint64 npages) {
+  int order = 0;
+  while ((1UL << order) < npages) order++;
+  return order;
+}
+
+void *alloc_page(void) { return alloc_pages(0); }
+
+void free_page(void *pa) { free_pages(pa); }
+
+static uint64 ref_pfn(void *pa) {
+  uint64 pfn = pa2pfn((uint64)pa);
+  if (((uint64)pa % PGSIZE) != 0 || (uint64)pa < free_mem_start_addr ||
+      (uint64)pa >= free_mem_end_addr || !(pg_desc[pfn] & PG_ALLOC))
+    panic("page reference 0x%lx \n", pa);
+  return pfn;
+}
+
+//
+// take one more reference to the allocated block at pa.
+//
+void get_page(void *pa) {
+  spinlock_lock(&pmm_lock);
+  uint64 pfn = ref_pfn(pa);
+  if (pg_ref[pfn] == 0xffff) panic("get_page: too many references to 0x%lx \n", pa);
+  pg_ref[pfn]++;
+  spinlock_unlock(&pmm_lock);
+}
+
+//
+// drop a reference to the allocated block at pa, which is freed with the last one.
+//
+void put_page(void *pa) {
+  spinlock_lock(&pmm_lock);
+  uint64 pfn = ref_pfn(pa);
+  if (--pg_ref[pfn] == 0) buddy_free(pa);
+  spinlock_unlock(&pmm_lock);
+}
+
+//
+// returns the number of references to the allocated block at pa.
+//
+int page_ref(void *pa) {
+  spinlock_lock(&pmm_lock);
+  int ref = pg_ref[ref_pfn(pa)];
+  spinlock_unlock(&pmm_lock);
+  return ref;
+}
+
+//
+// returns the number of free physical pages.
+//
+uint64 free_page_count(void) { return g_free_pages; }
+
+//
+// puts [start, end) on the free lists as the largest aligned blocks that fit.
+//
+static void add_free_range(uint64 start, uint64 end) {
+  while (start < end) {
+    uint64 pfn = pa2pfn(start);
+    int order = PMM_MAX_ORDER;
+    while (order > 0 && ((pfn & ((1UL << order) - 1)) || start + (PGSIZE << order) > end))
+      order--;
+    push_block(pfn, order);
+    g_free_pages += 1UL << order;
+    start += PGSIZE << order;
+  }
+}
+
+//
+// pmm_init() establishes the free lists according to available physical memory space.
+//
+void pmm_init() {
+  // start of kernel program segment
+  uint64 g_kernel_start = DRAM_BASE;
+  uint64 g_kernel_end = (uint64)&_end;
+
+  uint64 pke_kernel_size = g_kernel_end - g_kernel_start;
+  sprint("PKE kernel start 0x%lx, PKE kernel end: 0x%lx, PKE kernel size: 0x%lx .\n",
+    g_kernel_start, g_kernel_end, pke_kernel_size);
+
+  // the page descriptors and reference counts come right after the kernel, free memory
+  // starts after them
+  free_mem_end_addr = ROUNDDOWN(DRAM_BASE + g_mem_size, PGSIZE);
+  uint64 npages = pa2pfn(free_mem_end_addr);
+  pg_desc = (uint8 *)ROUNDUP(g_kernel_end, PGSIZE);
+  memzero(pg_desc, npages);
+  pg_ref = (uint16 *)ROUNDUP((uint64)pg_desc + npages, sizeof(uint16));
+  memzero(pg_ref, npages * sizeof(uint16));
+  free_mem_start_addr = ROUNDUP((uint64)(pg_ref + npages), PGSIZE);
+  if (free_mem_start_addr >= free_mem_end_addr)
+    panic("Not enough physical memory for PKE.\n");
+  sprint("free physical memory address: [0x%lx, 0x%lx] \n", free_mem_start_addr,
+    free_mem_end_addr - 1);
+
+  sprint("kernel memory manager is initializing ...\n");
+  for (int k = 0; k <= PMM_MAX_ORDER; k++) {
+    free_area[k].next = free_area[k].prev = &free_area[k];
+    nr_free[k] = 0;
+  }
+  g_free_pages = 0;
+  add_free_range(free_mem_start_addr, free_mem_end_addr);
+  sprint("%ld free physical pages.\n", g_free_pages);
+}
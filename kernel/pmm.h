@@ -0,0 +1,30 @@
+#ifndef _PMM_H_
+#define _PMM_H_
+
+#include "util/types.h"
+
+// the largest block handed out by the buddy allocator is 2^PMM_MAX_ORDER pages (16MB)
+#define PMM_MAX_ORDER 12
+
+// Initialize phisical memeory manager
+void pmm_init();
+// Allocate a free phisical page
+void* alloc_page();
+// Free an allocated page
+void free_page(void* pa);
+// Allocate 2^order physically contiguous pages, aligned to their size
+void* alloc_pages(int order);
+// Free a block allocated by alloc_pages()
+void free_pages(void* pa);
+// Allocate npages physically contiguous pages, each of which is freed by free_page()
+void* alloc_pages_exact(uint64 npages);
+// take and drop references to an allocated block, freed with its last reference
+void get_page(void* pa);
+void put_page(void* pa);
+int page_ref(void* pa);
+// smallest order whose block holds npages pages
+int pages_order(uint64 npages);
+// number of free physical pages
+uint64 free_page_count();
+
+#endif
@@ -1,9 +1,8 @@
 /*
  * Utility functions for process management. 
  *
- * Note: in Lab1, only one process (i.e., our user application) exists. Therefore, 
- * PKE OS at this stage will set "current" to the loaded user application, and also
- * switch to the old "current" process after trap handling.
+ * processes are created by loading the user application, and by fork. the scheduler
+ * (kernel/sched.c) puts the one chosen into "current".
  */
 
 #include "riscv.h"
@@ -11,16 +10,182 @@
 #include "config.h"
 #include "process.h"
 #include "elf.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "slab.h"
+#include "sched.h"
 #include "string.h"
+#include "util/functions.h"
 
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
 
 //Two functions defined in kernel/usertrap.S
 extern char smode_trap_vector[];
-extern void return_to_user(trapframe*);
+extern void return_to_user(trapframe *, uint64 satp);
 
-// current points to the currently running user-mode application.
-process* current = NULL;
+// trap_sec_start points to the beginning of S-mode trap segment (i.e., the entry point of
+// S-mode trap vector). added @lab2_1
+extern char trap_sec_start[];
+
+// per-hart state, current points to the process running on a hart
+cpu cpus[NCPU];
+
+// object caches of processes and their trapframes
+static kmem_cache proc_cache = KMEM_CACHE_INIT("process", sizeof(process), NULL);
+static kmem_cache trapframe_cache = KMEM_CACHE_INIT("trapframe", sizeof(trapframe), NULL);
+
+// process id of the next process created, and the number of processes not exited. both
+// are updated with atomics, so that idle harts can poll the latter without a lock.
+static uint64 next_pid = 0;
+static int nr_processes = 0;
+// exit code of the first process, the one the machine exits with
+static int init_exit_code = 0;
+
+//
+// allocate a process with its trapframe, kernel stack and page table, the latter mapping
+// the trapframe and the trap vector. its user address space is left empty. returns NULL
+// if memory is out.
+//
+process *alloc_process(void) {
+  process *proc = (process *)kmem_cache_alloc(&proc_cache);
+  if (!proc) return NULL;
+  memset(proc, 0, sizeof(process));
+
+  proc->trapframe = (trapframe *)kmem_cache_alloc(&trapframe_cache);
+  // allocate a page to store page directory. added @lab2_1
+  proc->pagetable = (pagetable_t)alloc_page();
+  void *kstack = alloc_page();
+  if (!proc->trapframe || !proc->pagetable || !kstack)
+    panic("alloc_process: out of memory.\n");
+
+  memset(proc->trapframe, 0, sizeof(trapframe));
+  memset((void *)proc->pagetable, 0, PGSIZE);
+  proc->kstack = (uint64)kstack + PGSIZE;  // user kernel stack top
+  proc->pid = atomic_add(&next_pid, 1);
+  atomic_add(&nr_processes, 1);
+  proc->status = BLOCKED;
+
+  // map the page of the trapframe in user space (direct mapping as in kernel space).
+  uint64 tf_page = ROUNDDOWN((uint64)proc->trapframe, PGSIZE);
+  user_vm_map(proc->pagetable, tf_page, PGSIZE, tf_page, prot_to_type(PROT_WRITE | PROT_READ, 0));
+
+  // map S-mode trap vector section in user space (direct mapping as in kernel space)
+  // here, we assume that the size of usertrap.S is smaller than a page.
+  user_vm_map(proc->pagetable, (uint64)trap_sec_start, PGSIZE, (uint64)trap_sec_start,
+         prot_to_type(PROT_READ | PROT_EXEC, 0));
+
+  return proc;
+}
+
+//
+// release a process that has exited: its user address space, trapframe and files. it
+// stays a ZOMBIE, with its kernel stack possibly still in use, until reap_process().
+//
+void free_process(process *proc) {
+  user_vm_destroy(proc->pagetable);
+  kmem_cache_free(&trapframe_cache, proc->trapframe);
+  if (proc->debug_arena.base) put_page((void *)proc->debug_arena.base);
+  if (proc->debug_file && proc->debug_file != proc->elf_file) spike_file_close(proc->debug_file);
+  if (proc->elf_file) spike_file_close(proc->elf_file);
+  if (proc->linetab_file) spike_file_close(proc->linetab_file);
+
+  if (proc->pid == 0) init_exit_code = proc->exit_code;
+  proc->status = ZOMBIE;
+  atomic_add(&nr_processes, -1);
+}
+
+//
+// free the kernel stack and the descriptor of a ZOMBIE, no hart may be running on it.
+//
+void reap_process(process *proc) {
+  assert(proc->status == ZOMBIE);
+  free_page((void *)(proc->kstack - PGSIZE));
+  kmem_cache_free(&proc_cache, proc);
+}
+
+//
+// returns the number of processes that have not exited.
+//
+int process_count(void) { return atomic_read(&nr_processes); }
+
+//
+// returns the exit code of the first process, once it has exited.
+//
+int process_exit_code(void) { return atomic_read(&init_exit_code); }
+
+//
+// create a child of parent, sharing its user pages copy-on-write. the child returns 0
+// from the fork syscall and is put into the ready queue. returns the pid of the child,
+// or -1 if memory is out.
+//
+int do_fork(process *parent) {
+  process *child = alloc_process();
+  if (!child) return -1;
+  if (user_vm_fork(child->pagetable, parent->pagetable) != 0) {
+    free_process(child);
+    reap_process(child);
+    return -1;
+  }
+
+  // the child resumes from the same syscall, with its own result
+  *child->trapframe = *parent->trapframe;
+  child->trapframe->regs.a0 = 0;
+  memcpy(child->vmas, parent->vmas, sizeof(parent->vmas));
+  child->nvmas = parent->nvmas;
+
+  // the elf is still read from on page faults. each process drops two references to it
+  // with spike_file_close().
+  if (parent->elf_file) {
+    spike_file_incref(parent->elf_file);
+    spike_file_incref(parent->elf_file);
+    child->elf_file = parent->elf_file;
+  }
+
+  // the debug tables are shared, read-only, with the arena holding them once built
+  if (parent->debug_arena.base) {
+    get_page((void *)parent->debug_arena.base);
+    child->debug_arena = parent->debug_arena;
+    child->debug_arena.size = parent->debug_arena.top - parent->debug_arena.base;
+  }
+  if (parent->debugline_state == DEBUG_READY) {
+    child->debugline = parent->debugline;
+    child->dir = parent->dir;
+    child->file = parent->file;
+    child->lines = parent->lines;
+    child->debugline_state = DEBUG_READY;
+  }
+  if (parent->symtab_state == DEBUG_READY) {
+    child->syms = parent->syms;
+    child->symtab_state = DEBUG_READY;
+  }
+  // tables not built yet (all of them are built together) are built by the child on its
+  // own first use, from the same sections. it takes its own references to the files.
+  if (parent->debugline_state == DEBUG_PENDING || parent->symtab_state == DEBUG_PENDING) {
+    if (parent->debug_file != parent->elf_file) {
+      spike_file_incref(parent->debug_file);
+      spike_file_incref(parent->debug_file);
+    }
+    child->debug_file = parent->debug_file;
+    if (parent->linetab_file) {
+      spike_file_incref(parent->linetab_file);
+      spike_file_incref(parent->linetab_file);
+      child->linetab_file = parent->linetab_file;
+    }
+    child->debugline_off = parent->debugline_off;
+    child->debugline_size = parent->debugline_size;
+    child->debugline_state = parent->debugline_state;
+    child->symtab_off = parent->symtab_off;
+    child->symtab_size = parent->symtab_size;
+    child->strtab_off = parent->strtab_off;
+    child->strtab_size = parent->strtab_size;
+    child->symtab_state = parent->symtab_state;
+  }
+
+  child->parent = parent;
+  insert_to_ready_queue(child);
+  return child->pid;
+}
 
 //
 // switch to a user-mode process
@@ -36,8 +201,10 @@ void switch_to(process* proc) {
 
   // set up trapframe values (in process structure) that smode_trap_vector will need when
   // the process next re-enters the kernel.
-  proc->trapframe->kernel_sp = proc->kstack;  // process's kernel stack
+  proc->trapframe->kernel_sp = proc->kstack;      // process's kernel stack
+  proc->trapframe->kernel_satp = read_csr(satp);  // kernel page table
   proc->trapframe->kernel_trap = (uint64)smode_trap_handler;
+  proc->trapframe->kernel_hartid = read_tp();  // hart the process runs on
 
   // SSTATUS_SPP and SSTATUS_SPIE are defined in kernel/riscv.h
   // set S Previous Privilege mode (the SSTATUS_SPP bit in sstatus register) to User mode.
@@ -51,6 +218,170 @@ void switch_to(process* proc) {
   // set S Exception Program Counter (sepc register) to the elf entry pc.
   write_csr(sepc, proc->trapframe->epc);
 
+  // make user page table. macro MAKE_SATP is defined in kernel/riscv.h. added @lab2_1
+  uint64 user_satp = MAKE_SATP(proc->pagetable);
+
   // return_to_user() is defined in kernel/strap_vector.S. switch to user mode with sret.
-  return_to_user(proc->trapframe);
+  // note, return_to_user takes two parameters @ and after lab2_1.
+  return_to_user(proc->trapframe, user_satp);
+}
+
+//
+// records the region [start, end) in the address space of p. returns NULL if p has no
+// free slot.
+//
+vm_area *add_vma(process *p, uint64 start, uint64 end, int type, int prot) {
+  if (p->nvmas >= MAX_VMAS) return NULL;
+
+  vm_area *vma = &p->vmas[p->nvmas++];
+  memset(vma, 0, sizeof(vm_area));
+  vma->start = start;
+  vma->end = end;
+  vma->type = type;
+  vma->prot = prot;
+  return vma;
+}
+
+//
+// returns the region of p whose pages cover va, or NULL.
+//
+vm_area *find_vma(process *p, uint64 va) {
+  for (int i = 0; i < p->nvmas; i++) {
+    vm_area *vma = &p->vmas[i];
+    if (va >= ROUNDDOWN(vma->start, PGSIZE) && va < ROUNDUP(vma->end, PGSIZE)) return vma;
+  }
+  return NULL;
+}
+
+//
+// returns the stack region of p extended down to the page of va, or NULL if va is out
+// of the reach of the stack: beyond its limit, or more than USER_STACK_GAP bytes below
+// both the stack region and the user stack pointer. a fault there is a bad access.
+//
+static vm_area *grow_stack(process *p, uint64 va) {
+  if (va < USER_STACK - USER_STACK_LIMIT || va >= USER_STACK) return NULL;
+  for (int i = 0; i < p->nvmas; i++) {
+    vm_area *vma = &p->vmas[i];
+    if (vma->type != VMA_STACK) continue;
+    if (va < vma->start) {
+      uint64 sp = p->trapframe->regs.sp;
+      if (va + USER_STACK_GAP < vma->start && va + USER_STACK_GAP < sp) return NULL;
+      vma->start = ROUNDDOWN(va, PGSIZE);
+    }
+    return vma;
+  }
+  return NULL;
+}
+
+//
+// whether va lies in the guard page below the lowest reach of the user stack.
+//
+int is_stack_guard(uint64 va) {
+  uint64 limit = USER_STACK - USER_STACK_LIMIT;
+  return va >= limit - PGSIZE && va < limit;
+}
+
+//
+// maps the page of va in the address space of p, populated according to its region.
+// an address below the stack, within its limit, grows the stack. returns 0 on success,
+// -1 if va lies in no region, is mapped already or memory is out.
+//
+int vma_populate(process *p, uint64 va) {
+  vm_area *vma = find_vma(p, va);
+  if (!vma) vma = grow_stack(p, va);
+  if (!vma || lookup_pa(p->pagetable, va)) return -1;
+
+  switch (vma->type) {
+    case VMA_FILE:
+      // elf_populate() is defined in kernel/elf.c
+      return elf_populate(p, vma, va);
+    case VMA_HEAP:
+    case VMA_ANON:
+    case VMA_STACK: {
+      if (vma->prot == PROT_NONE) return -1;
+      void *pa = alloc_page();
+      if (!pa) return -1;
+      memset(pa, 0, PGSIZE);
+      user_vm_map(p->pagetable, ROUNDDOWN(va, PGSIZE), PGSIZE, (uint64)pa,
+             prot_to_type(vma->prot, 1));
+      return 0;
+    }
+    default:
+      return -1;
+  }
+}
+
+//
+// move the program break of p by increment bytes. pages are only allocated when touched,
+// and those beyond a lowered break are freed. returns the previous break, or -1 if the
+// break would leave [heap start, USER_MMAP_BASE].
+//
+uint64 do_sbrk(process *p, int64 increment) {
+  vm_area *heap = NULL;
+  for (int i = 0; i < p->nvmas; i++)
+    if (p->vmas[i].type == VMA_HEAP) heap = &p->vmas[i];
+  if (!heap) return -1;
+
+  uint64 old = heap->end;
+  if (increment < 0 ? (uint64)-increment > old - heap->start
+                    : (uint64)increment > USER_MMAP_BASE - old)
+    return -1;
+
+  uint64 brk = old + increment;
+  uint64 keep = ROUNDUP(brk, PGSIZE), mapped = ROUNDUP(old, PGSIZE);
+  if (keep < mapped) user_vm_unmap(p->pagetable, keep, mapped - keep, 1);
+  heap->end = brk;
+  return old;
+}
+
+//
+// map length bytes of anonymous memory in p, at the lowest free address of the mmap area.
+// pages are only allocated when touched. returns the address, or -1 on failure.
+//
+uint64 do_mmap(process *p, uint64 length, int prot) {
+  if (length == 0 || length > USER_MMAP_END - USER_MMAP_BASE) return -1;
+  length = ROUNDUP(length, PGSIZE);
+
+  // first fit: move past every region overlapping [start, start + length)
+  uint64 start = USER_MMAP_BASE;
+  for (int i = 0; i < p->nvmas; i++) {
+    vm_area *v = &p->vmas[i];
+    if (v->start < v->end && v->start < start + length && start < ROUNDUP(v->end, PGSIZE)) {
+      start = ROUNDUP(v->end, PGSIZE);
+      i = -1;
+    }
+  }
+  if (start + length > USER_MMAP_END) return -1;
+
+  if (!add_vma(p, start, start + length, VMA_ANON, prot)) return -1;
+  return start;
+}
+
+//
+// unmap the anonymous mappings of p in [addr, addr + length), freeing their pages. a
+// mapping partly covered is trimmed, or split in two. returns 0 on success.
+//
+int do_munmap(process *p, uint64 addr, uint64 length) {
+  uint64 end = addr + ROUNDUP(length, PGSIZE);
+  if (addr % PGSIZE || length == 0 || end < addr) return -1;
+
+  for (int i = 0; i < p->nvmas; i++) {
+    vm_area *v = &p->vmas[i];
+    if (v->type != VMA_ANON || v->end <= addr || v->start >= end) continue;
+
+    uint64 lo = MAX(v->start, addr), hi = MIN(v->end, end);
+    if (lo > v->start && hi < v->end) {
+      // the middle of v goes, its tail becomes a region of its own
+      if (!add_vma(p, hi, v->end, VMA_ANON, v->prot)) return -1;
+      v->end = lo;
+    } else if (lo > v->start) {
+      v->end = lo;
+    } else if (hi < v->end) {
+      v->start = hi;
+    } else {
+      p->vmas[i--] = p->vmas[--p->nvmas];
+    }
+    user_vm_unmap(p->pagetable, lo, hi - lo, 1);
+  }
+  return 0;
 }
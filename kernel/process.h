@@ -2,6 +2,9 @@
 #define _PROC_H_
 
 #include "riscv.h"
+#include "config.h"
+#include "arena.h"
+#include "spike_interface/spike_file.h"
 
 typedef struct trapframe_t {
   // space to store context (all common registers)
@@ -13,6 +16,11 @@ typedef struct trapframe_t {
   /* offset:256 */ uint64 kernel_trap;
   // saved user process counter
   /* offset:264 */ uint64 epc;
+
+  // kernel page table. added @lab2_1
+  /* offset:272 */ uint64 kernel_satp;
+  // hartid of the hart running the process, restored into tp on entering the kernel
+  /* offset:280 */ uint64 kernel_hartid;
 }trapframe;
 
 // code file struct, including directory index and file name char pointer
@@ -25,19 +33,136 @@ typedef struct {
     uint64 addr, line, file;
 } addr_line;
 
+// number of rows per block of the compact line table
+#define LINE_BLOCK_ROWS 32
+
+// sparse index entry of the compact line table: the first row of a block in full, and
+// where the delta-encoded remaining rows of the block start
+typedef struct {
+    uint64 addr; uint32 line, file, off;
+} line_block;
+
+// compact line table: nblocks index entries followed by the delta-encoded rows
+typedef struct {
+    char *base; uint64 nrows, nblocks;
+} line_table;
+
+// function symbol: [start, start + size) with its name at offset name of the name pool.
+// a size of 0 means the symbol extends to the next one.
+typedef struct {
+    uint64 start; uint32 size, name;
+} func_sym;
+
+// function symbol index, sorted by start address
+typedef struct {
+    func_sym *syms; char *names; uint64 nsyms;
+} sym_table;
+
+// types of the regions of a user address space
+#define VMA_FILE 1  // a segment of the elf, read in on first touch
+#define VMA_HEAP 2  // the heap, grown and shrunk by sbrk, zero-filled on first touch
+#define VMA_ANON 3  // an anonymous mapping, zero-filled on first touch
+#define VMA_STACK 4  // the user stack, grown down on fault, zero-filled on first touch
+
+// maximum number of regions of a process
+#define MAX_VMAS 32
+
+// a region [start, end) of the user address space whose pages are populated on page
+// fault. the bytes [start, start + file_size) of a VMA_FILE region are at file_off in the
+// elf, the rest is zero.
+typedef struct vm_area_t {
+  uint64 start, end;
+  int type, prot;
+  uint64 file_off, file_size;
+} vm_area;
+
+// states of the debug tables (line table, symbol index) of a process, which are built
+// from the elf on first use
+#define DEBUG_NONE 0
+#define DEBUG_PENDING 1
+#define DEBUG_READY 2
+
+// possible status of a process
+enum proc_status {
+  FREE,     // unused state
+  READY,    // ready state
+  RUNNING,  // currently running
+  BLOCKED,  // waiting for something
+  ZOMBIE,   // terminated but not reclaimed yet
+};
+
 // the extremely simple definition of process, used for begining labs of PKE
 typedef struct process_t {
   // pointing to the stack used in trap handling.
   uint64 kstack;
+  // user page table
+  pagetable_t pagetable;
   // trapframe storing the context of a (User mode) process.
   trapframe* trapframe;
 
   // added @lab1_challenge2
-  char *debugline; char **dir; code_file *file; addr_line *line; int line_ind;
+  char *debugline; char **dir; code_file *file; line_table lines;
+  // where .debug_line is in the elf (kept open until then), and whether it is decoded
+  spike_file_t *debug_file; uint64 debugline_off, debugline_size; int debugline_state;
+  // the prebuilt line table sidecar, preferred to decoding .debug_line, kept open until then
+  spike_file_t *linetab_file;
+  // where .symtab and its string table are in the elf, and the function index built
+  // from them on first use
+  uint64 symtab_off, symtab_size, strtab_off, strtab_size; int symtab_state; sym_table syms;
+  // the debug tables of the process, all freed together
+  arena debug_arena;
+
+  // regions of the user address space populated on page fault
+  vm_area vmas[MAX_VMAS]; int nvmas;
+  // the elf, kept open while it has segments left to be read in on demand
+  spike_file_t *elf_file;
+
+  // process id
+  uint64 pid;
+  // process status
+  int status;
+  // parent process
+  struct process_t *parent;
+  // next queue element
+  struct process_t *queue_next;
+
+  // ticks of the current time slice
+  int tick_count;
+  // runtime accounting: ticks spent running, and time slices it was scheduled for
+  uint64 run_ticks, nr_slices;
+  // code passed to exit, or -1 if the process was killed
+  int exit_code;
 }process;
 
+// per-hart state of the kernel, indexed by hartid. tp holds the hartid in S-mode.
+typedef struct cpu_t {
+  // the process running on the hart
+  process *proc;
+  // timer ticks seen by the hart
+  uint64 ticks;
+} cpu;
+
+extern cpu cpus[NCPU];
+
+static inline cpu *mycpu(void) { return &cpus[read_tp()]; }
+
+// current points to the process running on this hart
+#define current (mycpu()->proc)
+
 void switch_to(process*);
+process *alloc_process(void);
+void free_process(process *proc);
+void reap_process(process *proc);
+int process_count(void);
+int process_exit_code(void);
+int do_fork(process *parent);
 
-extern process* current;
+vm_area *add_vma(process *p, uint64 start, uint64 end, int type, int prot);
+vm_area *find_vma(process *p, uint64 va);
+int vma_populate(process *p, uint64 va);
+int is_stack_guard(uint64 va);
+uint64 do_sbrk(process *p, int64 increment);
+uint64 do_mmap(process *p, uint64 length, int prot);
+int do_munmap(process *p, uint64 addr, uint64 length);
 
 #endif
@@ -0,0 +1,159 @@
+/*
+ * implementing the scheduler. each hart has a run queue of its own, where the processes
+ * it preempts or forks are put. a hart whose queue is empty steals the oldest process
+ * of the longest queue of the other harts.
+ */
+
+#include "sched.h"
+#include "riscv.h"
+#include "config.h"
+#include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
+
+// stack0 is defined in kernel/machine/minit.c. after boot, the stack of each hart in it
+// is where the hart schedules, off the kernel stack of any process.
+extern char stack0[];
+
+// a ready queue: a FIFO of processes in READY state, with its load-balancing statistics
+typedef struct run_queue_t {
+  process *head, *tail;
+  int nr;
+  spinlock_t lock;   // guards all of the above, and nr_stolen
+  uint64 nr_runs;    // processes the hart took from its own queue
+  uint64 nr_steals;  // processes the hart took from the queues of others
+  uint64 nr_stolen;  // processes other harts took from this queue
+  int max_nr;        // longest the queue has been
+} run_queue;
+
+static run_queue run_queues[NCPU] = {
+  [0 ... NCPU - 1] = { .lock = SPINLOCK_INIT_NAMED("run_queue") },
+};
+
+static process* dequeue(run_queue* rq) {
+  process* p = rq->head;
+  if (p) {
+    rq->head = p->queue_next;
+    rq->nr--;
+    p->status = RUNNING;
+  }
+  return p;
+}
+
+//
+// insert a process, proc, into the END of the ready queue of this hart.
+//
+void insert_to_ready_queue(process* proc) {
+  run_queue* rq = &run_queues[read_tp()];
+  spinlock_lock(&rq->lock);
+  // every process in a queue is READY, and only those
+  if (proc->status != READY) {
+    proc->status = READY;
+    proc->queue_next = NULL;
+    if (rq->head == NULL)
+      rq->head = proc;
+    else
+      rq->tail->queue_next = proc;
+    rq->tail = proc;
+    if (++rq->nr > rq->max_nr) rq->max_nr = rq->nr;
+  }
+  spinlock_unlock(&rq->lock);
+}
+
+//
+// take the oldest process of the longest queue of the other harts. the queue lengths are
+// read without their locks, as a hint. returns NULL if there is nothing to steal.
+//
+static process* steal(uint64 hartid) {
+  run_queue* victim = NULL;
+  for (int i = 1; i < NCPU; i++) {
+    run_queue* rq = &run_queues[(hartid + i) % NCPU];
+    if (rq->nr > 0 && (!victim || rq->nr > victim->nr)) victim = rq;
+  }
+  if (!victim) return NULL;
+
+  spinlock_lock(&victim->lock);
+  process* p = dequeue(victim);
+  if (p) victim->nr_stolen++;
+  spinlock_unlock(&victim->lock);
+  if (p) run_queues[hartid].nr_steals++;
+  return p;
+}
+
+//
+// print the load-balancing statistics of the run queues.
+//
+static void sched_print_stats(void) {
+  for (int i = 0; i < NCPU; i++) {
+    run_queue* rq = &run_queues[i];
+    sprint("hart %d: %ld runs from own queue, %ld stolen from others, %ld stolen by others, "
+      "longest queue %d\n", i, rq->nr_runs, rq->nr_steals, rq->nr_stolen, rq->max_nr);
+  }
+}
+
+//
+// the scheduler proper, running on the stack of this hart. the previous process is put
+// back into the ready queue if it is still runnable, or reaped if it has exited, and
+// the first process of the queue of the hart is switched to, or else one stolen from
+// another hart. the hart spins while there is none, and the machine shuts down when no
+// process is left.
+//
+static void scheduler(void) {
+  uint64 hartid = read_tp();
+  run_queue* rq = &run_queues[hartid];
+  process* prev = current;
+  current = NULL;
+  // once requeued, prev may be run, exit and be reaped by another hart at any time, so
+  // it is not looked at again
+  if (prev && prev->status == RUNNING)
+    insert_to_ready_queue(prev);
+  else if (prev && prev->status == ZOMBIE)
+    reap_process(prev);
+
+  process* next;
+  for (;;) {
+    spinlock_lock(&rq->lock);
+    next = dequeue(rq);
+    if (next) rq->nr_runs++;
+    spinlock_unlock(&rq->lock);
+    if (next || (next = steal(hartid)) != NULL) break;
+
+    // the processes running on the other harts may still fork or be preempted
+    if (process_count() == 0) {
+      if (SCHED_STATS) sched_print_stats();
+      if (LOCK_PROFILE) lock_stat_print();
+      sprint("no more ready processes, system shutdown now.\n");
+      shutdown(process_exit_code());
+    }
+  }
+
+  next->tick_count = 0;
+  next->nr_slices++;
+  current = next;
+  switch_to(next);
+}
+
+//
+// give the hart to the next ready process. the current process, if any, is requeued if
+// it is still RUNNING, or reaped if it is a ZOMBIE. since another hart may pick it up
+// (or free its kernel stack) as soon as it is requeued (or reaped), this is done on the
+// stack of the hart, never on the kernel stack of the process.
+//
+void schedule(void) {
+  uint64 sp = (uint64)stack0 + 4096 * (read_tp() + 1);
+  asm volatile("mv sp, %0\n"
+               "jr %1" ::"r"(sp), "r"(scheduler));
+  __builtin_unreachable();
+}
+
+//
+// charge the current tick to the current process, and preempt it at the end of its time
+// slice if another process is ready to run.
+//
+void rrsched(void) {
+  current->run_ticks++;
+  if (++current->tick_count < TIME_SLICE_LEN) return;
+
+  current->tick_count = 0;
+  // a process waiting in another queue is left to be stolen by an idle hart
+  if (run_queues[read_tp()].nr > 0) schedule();
+}
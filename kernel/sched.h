@@ -0,0 +1,14 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "process.h"
+
+//length of a time slice, in number of ticks
+#define TIME_SLICE_LEN  2
+
+void insert_to_ready_queue(process* proc);
+// never returns, the current process is requeued if still RUNNING
+void schedule(void) __attribute__((noreturn));
+void rrsched(void);
+
+#endif
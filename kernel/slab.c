@@ -0,0 +1,92 @@
+/*
+ * slab allocator for fixed-size kernel objects. each cache keeps a free list of its
+ * objects, carved from slabs taken from the page allocator. allocation and free are
+ * O(1), and an object goes back to the front of the free list, where it is picked by
+ * the next allocation while still in cache.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "riscv.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// caches that have carved a slab, for kmem_print_stats()
+static kmem_cache *kmem_caches;
+static spinlock_t kmem_caches_lock = SPINLOCK_INIT_NAMED("kmem_caches");
+
+static inline void **free_link(kmem_cache *c, void *obj) {
+  return (void **)((char *)obj + c->slot - sizeof(void *));
+}
+
+//
+// carve a new slab of c into constructed free objects. returns -1 if memory is out.
+//
+static int kmem_cache_grow(kmem_cache *c) {
+  if (c->slot == 0) {
+    c->slot = ROUNDUP(c->size, sizeof(void *)) + sizeof(void *);
+    c->order = pages_order(ROUNDUP(c->slot, PGSIZE) / PGSIZE);
+    spinlock_lock(&kmem_caches_lock);
+    c->next = kmem_caches;
+    kmem_caches = c;
+    spinlock_unlock(&kmem_caches_lock);
+  }
+
+  char *slab = (char *)alloc_pages(c->order);
+  if (!slab) return -1;
+
+  // link the objects in address order
+  uint64 n = (PGSIZE << c->order) / c->slot;
+  for (uint64 i = n; i > 0; i--) {
+    void *obj = slab + (i - 1) * c->slot;
+    if (c->ctor) c->ctor(obj);
+    *free_link(c, obj) = c->free;
+    c->free = obj;
+  }
+  c->nslabs++;
+  c->nobjs += n;
+  return 0;
+}
+
+//
+// allocate an object of c, returns NULL if memory is out.
+//
+void *kmem_cache_alloc(kmem_cache *c) {
+  spinlock_lock(&c->lock);
+  if (!c->free && kmem_cache_grow(c) != 0) {
+    spinlock_unlock(&c->lock);
+    return NULL;
+  }
+
+  void *obj = c->free;
+  c->free = *free_link(c, obj);
+  c->inuse++;
+  c->nallocs++;
+  spinlock_unlock(&c->lock);
+  return obj;
+}
+
+//
+// return obj to c. it must be left in constructed state.
+//
+void kmem_cache_free(kmem_cache *c, void *obj) {
+  if (!obj) return;
+  spinlock_lock(&c->lock);
+  kassert(c->inuse > 0);
+
+  *free_link(c, obj) = c->free;
+  c->free = obj;
+  c->inuse--;
+  spinlock_unlock(&c->lock);
+}
+
+//
+// print the usage of all caches in use.
+//
+void kmem_print_stats(void) {
+  spinlock_lock(&kmem_caches_lock);
+  for (kmem_cache *c = kmem_caches; c; c = c->next)
+    sprint("slab %s: %ld/%ld objects in use, %ld slabs of %ld pages, %ld allocations\n",
+      c->name, c->inuse, c->nobjs, c->nslabs, 1L << c->order, c->nallocs);
+  spinlock_unlock(&kmem_caches_lock);
+}
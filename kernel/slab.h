@@ -0,0 +1,31 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "util/types.h"
+#include "spike_interface/atomic.h"
+
+// an object cache: objects of one size carved from slabs of 2^order pages. free objects
+// stay constructed, ctor only runs when a slab is carved.
+typedef struct kmem_cache_t {
+  const char *name;
+  uint64 size;              // object size
+  void (*ctor)(void *obj);  // constructor, may be NULL
+
+  // set up when the first slab is carved
+  uint64 slot;   // object size plus the free list link, 8-byte aligned
+  int order;     // slabs are blocks of 2^order pages
+  void *free;    // free objects, linked through the word after each object
+  uint64 nslabs, nobjs, inuse, nallocs;
+  struct kmem_cache_t *next;  // caches in use
+  spinlock_t lock;            // guards all of the above
+} kmem_cache;
+
+// static initializer of a cache of objects of size bytes
+#define KMEM_CACHE_INIT(n, sz, c) \
+  { .name = (n), .size = (sz), .ctor = (c), .lock = SPINLOCK_INIT_NAMED(n) }
+
+void *kmem_cache_alloc(kmem_cache *c);
+void kmem_cache_free(kmem_cache *c, void *obj);
+void kmem_print_stats(void);
+
+#endif
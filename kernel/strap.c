@@ -6,6 +6,8 @@
 #include "process.h"
 #include "strap.h"
 #include "syscall.h"
+#include "vmm.h"
+#include "sched.h"
 
 #include "spike_interface/spike_utils.h"
 
@@ -19,17 +21,44 @@ static void handle_syscall(trapframe *tf) {
 }
 
 //
-// global variable that store the recorded "ticks". added @lab1_3
-static uint64 g_ticks = 0;
+// terminate the current process on a fault it cannot recover from. the other processes,
+// and the kernel, carry on.
 //
-// added @lab1_3
+static void kill_current(void) {
+  current->exit_code = -1;
+  free_process(current);
+  schedule();
+}
+
+//
+// handles a page fault of the current process: a store to a page shared copy-on-write
+// copies it, otherwise the page of stval is populated from the region of the address
+// space covering it. any other fault is a bad access, which kills the process.
+//
+void handle_user_page_fault(uint64 mcause, uint64 sepc, uint64 stval) {
+  if (stval >= MAXVA) {
+    sprint("bad access: 0x%lx is out of the user address space, sepc=%p\n", stval, sepc);
+    kill_current();
+  }
+  if (mcause == CAUSE_STORE_PAGE_FAULT && user_vm_cow(current->pagetable, stval) == 0) return;
+  if (is_stack_guard(stval)) {
+    sprint("stack overflow: 0x%lx is in the stack guard page, sepc=%p\n", stval, sepc);
+    kill_current();
+  }
+  // a page that is mapped already faulted on its permissions
+  if (vma_populate(current, stval) != 0) {
+    sprint("bad access: no mapping for 0x%lx, sepc=%p\n", stval, sepc);
+    kill_current();
+  }
+}
+
+//
+// the "ticks" are recorded per hart, in mycpu()->ticks. added @lab1_3
 //
 void handle_mtimer_trap() {
-  sprint("Ticks %d\n", g_ticks);
-  // TODO (lab1_3): increase g_ticks to record this "tick", and then clear the "SIP"
-  // field in sip register.
-  // hint: use write_csr to disable the SIP_SSIP bit in sip.
-  g_ticks++;
+  sprint("Ticks %d\n", mycpu()->ticks);
+  // count the tick on this hart, and clear the soft interrupt that M-mode raised for it
+  mycpu()->ticks++;
   write_csr(sip, 0);
 }
 
@@ -55,6 +84,12 @@ void smode_trap_handler(void) {
     handle_syscall(current->trapframe);
   } else if (cause == CAUSE_MTIMER_S_TRAP) {  //soft trap generated by timer interrupt in M mode
     handle_mtimer_trap();
+    // invoke round-robin scheduler.
+    rrsched();
+  } else if (cause == CAUSE_FETCH_PAGE_FAULT || cause == CAUSE_LOAD_PAGE_FAULT ||
+             cause == CAUSE_STORE_PAGE_FAULT) {
+    // the address of missing page is stored in stval
+    handle_user_page_fault(cause, read_csr(sepc), read_csr(stval));
   } else {
     sprint("smode_trap_handler(): unexpected scause %p\n", read_csr(scause));
     sprint("            sepc=%p stval=%p\n", read_csr(sepc), read_csr(stval));
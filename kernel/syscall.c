@@ -9,15 +9,34 @@
 #include "syscall.h"
 #include "string.h"
 #include "process.h"
+#include "vmm.h"
+#include "slab.h"
+#include "sched.h"
 #include "util/functions.h"
 
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
 
 //
 // implement the SYS_user_print syscall
 //
 ssize_t sys_user_print(const char* buf, size_t n) {
-  sprint(buf);
+  // buf is an address in user space on user stack,
+  // so we have to transfer it into phisical address (kernel is running in direct mapping).
+  // it may span several pages, which are not contiguous in physical memory, so it is
+  // written out one page at a time.
+  assert(current);
+  for (size_t done = 0; done < n;) {
+    uint64 va = (uint64)buf + done;
+    size_t len = MIN(n - done, PGSIZE - (va & (PGSIZE - 1)));
+    char* pa = (char*)user_va_to_pa_readable((pagetable_t)(current->pagetable), (void*)va);
+    // the page may not have been touched by the application yet
+    if (!pa && vma_populate(current, va) == 0)
+      pa = (char*)user_va_to_pa_readable((pagetable_t)(current->pagetable), (void*)va);
+    if (!pa) return -1;
+    spike_file_write(stderr, pa, len);
+    done += len;
+  }
   return 0;
 }
 
@@ -26,9 +45,68 @@ ssize_t sys_user_print(const char* buf, size_t n) {
 //
 ssize_t sys_user_exit(uint64 code) {
   sprint("User exit with code:%d.\n", code);
-  // in lab1, PKE considers only one app (one process). 
-  // therefore, shutdown the system when the app calls exit()
-  shutdown(code);
+  sprint("process %ld ran for %ld ticks in %ld time slices.\n", current->pid,
+    current->run_ticks, current->nr_slices);
+  if (KMEM_STATS) kmem_print_stats();
+  // reclaim the current process, and reschedule.
+  current->exit_code = code;
+  free_process(current);
+  schedule();
+  return 0;
+}
+
+//
+// implement the SYS_user_sbrk syscall. returns the previous program break, or -1.
+//
+ssize_t sys_user_sbrk(int64 increment) {
+  assert(current);
+  return do_sbrk(current, increment);
+}
+
+//
+// implement the SYS_user_mmap syscall. only anonymous mappings are supported, and the
+// address hint is ignored. returns the address of the mapping, or -1.
+//
+ssize_t sys_user_mmap(uint64 addr, uint64 length, int prot) {
+  assert(current);
+  if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) return -1;
+  return do_mmap(current, length, prot);
+}
+
+//
+// implement the SYS_user_munmap syscall
+//
+ssize_t sys_user_munmap(uint64 addr, uint64 length) {
+  assert(current);
+  return do_munmap(current, addr, length);
+}
+
+//
+// implement the SYS_user_fork syscall. returns the pid of the child to the parent, 0 to
+// the child, or -1.
+//
+ssize_t sys_user_fork(void) {
+  assert(current);
+  return do_fork(current);
+}
+
+//
+// implement the SYS_user_yield syscall: the current process gives up the rest of its
+// time slice.
+//
+ssize_t sys_user_yield(void) {
+  assert(current);
+  // schedule() puts the current process back into the ready queue
+  schedule();
+  return 0;
+}
+
+//
+// implement the SYS_user_lock_stats syscall: print the spinlock profile (LOCK_PROFILE)
+//
+ssize_t sys_user_lock_stats(void) {
+  lock_stat_print();
+  return 0;
 }
 
 //
@@ -41,6 +119,18 @@ long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, l
       return sys_user_print((const char*)a1, a2);
     case SYS_user_exit:
       return sys_user_exit(a1);
+    case SYS_user_sbrk:
+      return sys_user_sbrk(a1);
+    case SYS_user_mmap:
+      return sys_user_mmap(a1, a2, a3);
+    case SYS_user_munmap:
+      return sys_user_munmap(a1, a2);
+    case SYS_user_fork:
+      return sys_user_fork();
+    case SYS_user_yield:
+      return sys_user_yield();
+    case SYS_user_lock_stats:
+      return sys_user_lock_stats();
     default:
       panic("Unknown syscall %ld \n", a0);
   }
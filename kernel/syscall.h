@@ -8,6 +8,12 @@
 #define SYS_user_base 64
 #define SYS_user_print (SYS_user_base + 0)
 #define SYS_user_exit (SYS_user_base + 1)
+#define SYS_user_sbrk (SYS_user_base + 2)
+#define SYS_user_mmap (SYS_user_base + 3)
+#define SYS_user_munmap (SYS_user_base + 4)
+#define SYS_user_fork (SYS_user_base + 5)
+#define SYS_user_yield (SYS_user_base + 6)
+#define SYS_user_lock_stats (SYS_user_base + 7)
 
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7);
 
@@ -0,0 +1,321 @@
+/*
+ * virtual address mapping related functions.
+ */
+
+#include "vmm.h"
+#include "riscv.h"
+#include "pmm.h"
+#include "config.h"
+#include "util/types.h"
+#include "util/string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+/* --- utility functions for virtual address mapping --- */
+//
+// establish mapping of virtual address [va, va+size] to phyiscal address [pa, pa+size]
+// with the permission of "perm".
+//
+int map_pages(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+  uint64 first, last;
+  pte_t *pte;
+
+  for (first = ROUNDDOWN(va, PGSIZE), last = ROUNDDOWN(va + size - 1, PGSIZE);
+      first <= last; first += PGSIZE, pa += PGSIZE) {
+    if ((pte = page_walk(page_dir, first, 1)) == 0) return -1;
+    if (*pte & PTE_V)
+      panic("map_pages fails on mapping va (0x%lx) to pa (0x%lx)", first, pa);
+    *pte = PA2PTE(pa) | perm | PTE_V;
+  }
+  return 0;
+}
+
+//
+// convert permission code to permission types of PTE
+//
+uint64 prot_to_type(int prot, int user) {
+  uint64 perm = 0;
+  if (prot & PROT_READ) perm |= PTE_R | PTE_A;
+  if (prot & PROT_WRITE) perm |= PTE_W | PTE_D;
+  if (prot & PROT_EXEC) perm |= PTE_X | PTE_A;
+  if (perm == 0) perm = PTE_R;
+  if (user) perm |= PTE_U;
+  return perm;
+}
+
+//
+// traverse the page table (starting from page_dir) down to "level" to find the
+// corresponding pte of va. the walk stops early at a superpage leaf. the level of the
+// returned pte is stored in *at if at is not NULL.
+//
+static pte_t *walk_level(pagetable_t page_dir, uint64 va, int level, int alloc, int *at) {
+  if (va >= MAXVA) panic("page_walk");
+
+  // starting from the page directory
+  pagetable_t pt = page_dir;
+  int l;
+
+  // traverse from page directory to page table.
+  // as we use risc-v sv39 paging scheme, there will be 3 layers: page dir,
+  // page medium dir, and page table.
+  for (l = 2; l > level; l--) {
+    // macro "PX" gets the PTE index in page table of current level
+    // "pte" points to the entry of current level
+    pte_t *pte = pt + PX(l, va);
+
+    // now, we need to know if above pte is valid (established mapping to a phyiscal page)
+    // or not.
+    if (*pte & PTE_V) {  // PTE valid
+      // a 2MB or 1GB page maps va itself
+      if (PTE_LEAF(*pte)) break;
+      // phisical address of pagetable of next level
+      pt = (pagetable_t)PTE2PA(*pte);
+    } else {  // PTE invalid (not exist).
+      // allocate a page (to be the new pagetable), if alloc == 1
+      if (alloc && ((pt = (pte_t *)alloc_page()) != 0)) {
+        memset(pt, 0, PGSIZE);
+        // writes the physical address of newly allocated page to pte, to establish the
+        // page table tree.
+        *pte = PA2PTE(pt) | PTE_V;
+      } else  // returns NULL, if alloc == 0, or no more physical page remains
+        return 0;
+    }
+  }
+
+  if (at) *at = l;
+  // return a PTE which contains phisical address of a page
+  return pt + PX(l, va);
+}
+
+//
+// traverse the page table (starting from page_dir) to find the corresponding pte of va.
+// returns: PTE (page table entry) pointing to va, which is a superpage leaf if va lies
+// in a 2MB or 1GB page.
+//
+pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
+  return walk_level(page_dir, va, 0, alloc, NULL);
+}
+
+//
+// look up a virtual page address, return the physical page address or 0 if not mapped.
+//
+uint64 lookup_pa(pagetable_t pagetable, uint64 va) {
+  pte_t *pte;
+  uint64 pa;
+  int level;
+
+  if (va >= MAXVA) return 0;
+
+  pte = walk_level(pagetable, va, 0, 0, &level);
+  if (pte == 0 || (*pte & PTE_V) == 0 || ((*pte & PTE_R) == 0 && (*pte & PTE_W) == 0))
+    return 0;
+  // within a superpage, the page of va is at its offset from the superpage base
+  pa = PTE2PA(*pte) + (ROUNDDOWN(va, PGSIZE) & (PXSIZE(level) - 1));
+
+  return pa;
+}
+
+/* --- kernel page table part --- */
+// _etext is defined in kernel.lds, it points to the address after text and rodata segments.
+extern char _etext[];
+// the S-mode trap vector page, defined in kernel/strap_vector.S
+extern char trap_sec_start[];
+// g_mem_size is defined in spike_interface/spike_memory.c, size of the emulated memory
+extern uint64 g_mem_size;
+
+// pointer to kernel page director
+pagetable_t g_kernel_pagetable;
+
+// number of 4KB, 2MB and 1GB leaves in the kernel page table
+static uint64 kern_leaves[3];
+
+//
+// maps virtual address [va, va+sz) to [pa, pa+sz) (for kernel), page aligned. each piece
+// is mapped by the largest leaf (1GB, 2MB or 4KB) that va and pa are aligned to and that
+// fits in the range, so 4KB pages are only used at the unaligned edges.
+//
+void kern_vm_map(pagetable_t page_dir, uint64 va, uint64 pa, uint64 sz, int perm) {
+  uint64 end = va + sz;
+
+  while (va < end) {
+    int level = 2, at;
+    while (level > 0 && (((va | pa) & (PXSIZE(level) - 1)) || va + PXSIZE(level) > end))
+      level--;
+
+    pte_t *pte = walk_level(page_dir, va, level, 1, &at);
+    if (pte == 0) panic("kern_vm_map");
+    if (at != level || (*pte & PTE_V))
+      panic("kern_vm_map fails on mapping va (0x%lx) to pa (0x%lx)", va, pa);
+    *pte = PA2PTE(pa) | perm | PTE_V;
+
+    kern_leaves[level]++;
+    va += PXSIZE(level);
+    pa += PXSIZE(level);
+  }
+}
+
+//
+// kern_vm_init() constructs the kernel page table.
+//
+void kern_vm_init(void) {
+  // pagetable_t is defined in kernel/riscv.h. it's actually uint64*
+  pagetable_t t_page_dir;
+
+  // allocate a page (t_page_dir) to be the page directory for kernel. alloc_page is defined
+  // in kernel/pmm.c
+  t_page_dir = (pagetable_t)alloc_page();
+  memset(t_page_dir, 0, PGSIZE);
+
+  // map virtual address [KERN_BASE, _etext] to physical address [DRAM_BASE,
+  // DRAM_BASE+(_etext - KERN_BASE)], to maintain (direct) text section kernel address mapping.
+  // the trap vector page is also mapped at the same address in user page tables, it keeps
+  // a 4KB page of its own.
+  uint64 trap_page = (uint64)trap_sec_start;
+  kern_vm_map(t_page_dir, KERN_BASE, DRAM_BASE, trap_page - KERN_BASE,
+         prot_to_type(PROT_READ | PROT_EXEC, 0));
+  if (map_pages(t_page_dir, trap_page, PGSIZE, trap_page,
+                prot_to_type(PROT_READ | PROT_EXEC, 0)) != 0)
+    panic("kern_vm_init");
+  kern_leaves[0]++;
+  kern_vm_map(t_page_dir, trap_page + PGSIZE, trap_page + PGSIZE,
+         (uint64)_etext - (trap_page + PGSIZE), prot_to_type(PROT_READ | PROT_EXEC, 0));
+
+  sprint("KERN_BASE 0x%lx\n", lookup_pa(t_page_dir, KERN_BASE));
+
+  // also (direct) map remaining address space, to make them accessable from kernel.
+  // this is important when kernel needs to access the memory content of user's app
+  // without copying pages between kernel and user spaces.
+  uint64 phys_top = ROUNDDOWN(DRAM_BASE + g_mem_size, PGSIZE);
+  kern_vm_map(t_page_dir, (uint64)_etext, (uint64)_etext, phys_top - (uint64)_etext,
+         prot_to_type(PROT_READ | PROT_WRITE, 0));
+
+  sprint("physical address of _etext is: 0x%lx\n", lookup_pa(t_page_dir, (uint64)_etext));
+  sprint("kernel direct map: %ld 1GB, %ld 2MB and %ld 4KB pages\n", kern_leaves[2],
+    kern_leaves[1], kern_leaves[0]);
+
+  g_kernel_pagetable = t_page_dir;
+}
+
+/* --- user page table part --- */
+//
+// convert and return the corresponding physical address of a virtual address (va) of
+// application. returns NULL if va is not mapped.
+//
+void *user_va_to_pa(pagetable_t page_dir, void *va) {
+  uint64 pa = lookup_pa(page_dir, (uint64)va);
+  if (!pa) return NULL;
+  return (void *)(pa + ((uint64)va & (PGSIZE - 1)));
+}
+
+//
+// like user_va_to_pa(), but only for a page the application may read itself (PTE_U and
+// PTE_R), for reading buffers passed in by it. the trapframe and trap vector pages are
+// mapped in its page table too, without PTE_U.
+//
+void *user_va_to_pa_readable(pagetable_t page_dir, void *va) {
+  if ((uint64)va >= MAXVA) return NULL;
+  pte_t *pte = page_walk(page_dir, (uint64)va, 0);
+  if (pte == 0 || (*pte & (PTE_V | PTE_U | PTE_R)) != (PTE_V | PTE_U | PTE_R)) return NULL;
+  return user_va_to_pa(page_dir, va);
+}
+
+//
+// maps virtual address [va, va+sz] to [pa, pa+sz] (for user application).
+//
+void user_vm_map(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+  if (map_pages(page_dir, va, size, pa, perm) != 0) {
+    panic("fail to user_vm_map .\n");
+  }
+}
+
+//
+// unmap virtual address [va, va+size] from the user app.
+// reclaim the physical pages if free!=0
+//
+void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free) {
+  for (uint64 a = ROUNDDOWN(va, PGSIZE); a < va + size; a += PGSIZE) {
+    pte_t *pte = page_walk(page_dir, a, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0) continue;
+    if (free) put_page((void *)PTE2PA(*pte));
+    *pte = 0;
+  }
+  flush_tlb();
+}
+
+//
+// share the user pages mapped by the level "level" table pt (covering va onwards) with
+// page_dir. writable pages turn read-only and copy-on-write in both tables.
+//
+static int fork_level(pagetable_t page_dir, pagetable_t pt, int level, uint64 va) {
+  for (int i = 0; i < 512; i++, va += PXSIZE(level)) {
+    pte_t *pte = pt + i;
+    if ((*pte & PTE_V) == 0) continue;
+
+    if (!PTE_LEAF(*pte)) {
+      if (fork_level(page_dir, (pagetable_t)PTE2PA(*pte), level - 1, va) != 0) return -1;
+      continue;
+    }
+    // the trapframe and trap vector pages are mapped afresh for every process
+    if ((*pte & PTE_U) == 0) continue;
+    if (level != 0) panic("user_vm_fork: user superpage at 0x%lx", va);
+
+    if (*pte & PTE_W) *pte = (*pte & ~PTE_W) | PTE_COW;
+    pte_t *child = page_walk(page_dir, va, 1);
+    if (child == 0) return -1;
+    *child = *pte;
+    get_page((void *)PTE2PA(*pte));
+  }
+  return 0;
+}
+
+//
+// map the user pages of src in dst, shared copy-on-write: a store to such a page by
+// either side faults, and user_vm_cow() gives the writer a copy of its own. returns -1
+// if memory is out.
+//
+int user_vm_fork(pagetable_t dst, pagetable_t src) {
+  int r = fork_level(dst, src, 2, 0);
+  // the pages of src turned read-only
+  flush_tlb();
+  return r;
+}
+
+//
+// resolve a store to the copy-on-write page of va. the page is copied unless no one else
+// refers to it any more. returns 0 on success, -1 if the page is not copy-on-write or
+// memory is out.
+//
+int user_vm_cow(pagetable_t page_dir, uint64 va) {
+  pte_t *pte = page_walk(page_dir, va, 0);
+  if (pte == 0 || (*pte & (PTE_V | PTE_COW)) != (PTE_V | PTE_COW)) return -1;
+
+  void *pa = (void *)PTE2PA(*pte);
+  if (page_ref(pa) > 1) {
+    void *copy = alloc_page();
+    if (!copy) return -1;
+    memcpy(copy, pa, PGSIZE);
+    put_page(pa);
+    pa = copy;
+  }
+  *pte = PA2PTE(pa) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W | PTE_D;
+  flush_tlb();
+  return 0;
+}
+
+static void free_level(pagetable_t pt) {
+  for (int i = 0; i < 512; i++) {
+    pte_t pte = pt[i];
+    if ((pte & PTE_V) == 0) continue;
+    if (!PTE_LEAF(pte))
+      free_level((pagetable_t)PTE2PA(pte));
+    else if (pte & PTE_U)
+      put_page((void *)PTE2PA(pte));
+  }
+  free_page(pt);
+}
+
+//
+// free a user page table, together with its page-table pages, dropping a reference to
+// every user page it maps.
+//
+void user_vm_destroy(pagetable_t page_dir) { free_level(page_dir); }
@@ -5,25 +5,66 @@
 #ifndef _RISCV_ATOMIC_H_
 #define _RISCV_ATOMIC_H_
 
+#include "kernel/config.h"
+
 // Currently, interrupts are always disabled in M-mode.
 // todo: for PKE, wo turn on irq in lab_1_3_timer, so wo have to implement these two functions.
 #define disable_irqsave() (0)
 #define enable_irqrestore(flags) ((void)(flags))
 
-typedef struct {
-  int lock;
+// number of contended call sites recorded per lock when LOCK_PROFILE is set
+#define LOCK_PROFILE_SITES 4
+
+// a call site of spinlock_lock(), and how it waited for the lock
+typedef struct lock_site_t {
+  const char* site;  // "file:line"
+  unsigned long contended, spins;
+} lock_site;
+
+// profile of a lock, updated by its holder
+typedef struct lock_stat_t {
+  unsigned long acquisitions, contended, spins;
+  unsigned long hold_cycles, acquired_at;
+  lock_site sites[LOCK_PROFILE_SITES];
+  struct spinlock_t_* next;  // profiled locks, linked on first acquisition
+  int registered;
+} lock_stat;
+
+// a ticket lock: harts take increasing tickets from next, and enter in ticket order as
+// owner advances, so waiters are served first come, first served.
+typedef struct spinlock_t_ {
+  unsigned int next;   // next ticket to hand out
+  unsigned int owner;  // ticket of the holder
   // For debugging:
-  char* name;       // Name of lock.
-  struct cpu* cpu;  // The cpu holding the lock.
+  char* name;  // Name of lock.
+  int cpu;     // hartid + 1 of the hart holding the lock, 0 if free.
+#if LOCK_PROFILE
+  lock_stat stat;
+#endif
 } spinlock_t;
 
+// defined in spike_interface/lock_stat.c
+void lock_stat_acquired(spinlock_t* lock, const char* site, unsigned long spins);
+void lock_stat_released(spinlock_t* lock);
+void lock_stat_print(void);
+
 #define SPINLOCK_INIT \
   { 0 }
+#define SPINLOCK_INIT_NAMED(n) \
+  { .name = (n) }
 
 #define mb() asm volatile("fence" ::: "memory")
 #define atomic_set(ptr, val) (*(volatile typeof(*(ptr))*)(ptr) = val)
 #define atomic_read(ptr) (*(volatile typeof(*(ptr))*)(ptr))
 
+#ifdef __riscv_atomic
+// the A extension: AMOs for the read-modify-write operations, LR/SC for cas
+#define atomic_add(ptr, inc) __sync_fetch_and_add(ptr, inc)
+#define atomic_or(ptr, inc) __sync_fetch_and_or(ptr, inc)
+#define atomic_swap(ptr, swp) __sync_lock_test_and_set(ptr, swp)
+#define atomic_cas(ptr, cmp, swp) __sync_val_compare_and_swap(ptr, cmp, swp)
+#else
+// without the A extension, only correct on a single hart (see NCPU in kernel/config.h)
 #define atomic_binop(ptr, inc, op)         \
   ({                                       \
     long flags = disable_irqsave();        \
@@ -43,23 +84,46 @@ typedef struct {
     enable_irqrestore(flags);                               \
     res;                                                    \
   })
+#endif
+
+// the hartid, kept in tp by the kernel in both M and S modes
+static inline int spinlock_hartid(void) {
+  long x;
+  asm volatile("mv %0, tp" : "=r"(x));
+  return x;
+}
 
+// take the lock if it is free, returns 0 on success.
 static inline int spinlock_trylock(spinlock_t* lock) {
-  int res = atomic_swap(&lock->lock, -1);
+  unsigned int owner = atomic_read(&lock->owner);
+  if (atomic_cas(&lock->next, owner, owner + 1) != owner) return -1;
   mb();
-  return res;
+  lock->cpu = spinlock_hartid() + 1;
+  if (LOCK_PROFILE) lock_stat_acquired(lock, 0, 0);
+  return 0;
 }
 
-static inline void spinlock_lock(spinlock_t* lock) {
-  do {
-    while (atomic_read(&lock->lock))
-      ;
-  } while (spinlock_trylock(lock));
+// site is where the lock is taken, recorded when LOCK_PROFILE is set
+static inline void spinlock_lock_at(spinlock_t* lock, const char* site) {
+  unsigned int ticket = atomic_add(&lock->next, 1);
+  unsigned long spins = 0;
+  while (atomic_read(&lock->owner) != ticket)
+    spins++;
+  mb();
+  lock->cpu = spinlock_hartid() + 1;
+  if (LOCK_PROFILE) lock_stat_acquired(lock, site, spins);
 }
 
+#define LOCK_STR_(x) #x
+#define LOCK_STR(x) LOCK_STR_(x)
+#define spinlock_lock(lock) spinlock_lock_at(lock, __FILE__ ":" LOCK_STR(__LINE__))
+
 static inline void spinlock_unlock(spinlock_t* lock) {
+  if (LOCK_PROFILE) lock_stat_released(lock);
+  lock->cpu = 0;
   mb();
-  atomic_set(&lock->lock, 0);
+  // only the holder writes owner
+  atomic_set(&lock->owner, lock->owner + 1);
 }
 
 static inline long spinlock_lock_irqsave(spinlock_t* lock) {
@@ -0,0 +1,106 @@
+/*
+ * spinlock contention profiler, enabled by LOCK_PROFILE in kernel/config.h. each lock
+ * counts its acquisitions, the spins of the acquisitions that had to wait and the cycles
+ * it was held, together with the call sites that waited most. the counts are updated
+ * by the holder of the lock, so they need no lock of their own.
+ */
+
+#include "atomic.h"
+#include "spike_utils.h"
+
+#if LOCK_PROFILE
+
+// number of call sites in the report of the most contended ones
+#define LOCK_PROFILE_TOP 8
+
+// locks acquired at least once
+static spinlock_t* lock_stat_list;
+
+static inline unsigned long read_cycle(void) {
+  unsigned long x;
+  asm volatile("rdcycle %0" : "=r"(x));
+  return x;
+}
+
+//
+// account an acquisition of lock at site (may be NULL), after spins spins.
+//
+void lock_stat_acquired(spinlock_t* lock, const char* site, unsigned long spins) {
+  lock_stat* s = &lock->stat;
+  if (!s->registered) {
+    spinlock_t* head;
+    s->registered = 1;
+    do {
+      head = atomic_read(&lock_stat_list);
+      s->next = head;
+    } while (atomic_cas(&lock_stat_list, head, lock) != head);
+  }
+
+  s->acquisitions++;
+  if (spins) {
+    s->contended++;
+    s->spins += spins;
+    // a site is dropped once LOCK_PROFILE_SITES others have taken the slots
+    for (int i = 0; site && i < LOCK_PROFILE_SITES; i++) {
+      lock_site* ls = &s->sites[i];
+      if (ls->site && ls->site != site) continue;
+      ls->site = site;
+      ls->contended++;
+      ls->spins += spins;
+      break;
+    }
+  }
+  s->acquired_at = read_cycle();
+}
+
+//
+// account the cycles lock was held, just before it is released.
+//
+void lock_stat_released(spinlock_t* lock) {
+  lock->stat.hold_cycles += read_cycle() - lock->stat.acquired_at;
+}
+
+//
+// print the profile of every lock acquired so far, and the call sites that spun most.
+//
+void lock_stat_print(void) {
+  struct {
+    spinlock_t* lock;
+    lock_site* site;
+  } top[LOCK_PROFILE_TOP];
+  int ntop = 0;
+
+  sprint("lock profile (acquisitions, contended, spins, hold cycles):\n");
+  for (spinlock_t* l = atomic_read(&lock_stat_list); l; l = l->stat.next) {
+    lock_stat* s = &l->stat;
+    sprint("  %s: %ld, %ld, %ld, %ld\n", l->name ? l->name : "(unnamed)", s->acquisitions,
+      s->contended, s->spins, s->hold_cycles);
+
+    // keep top[] sorted by spins, most first
+    for (int i = 0; i < LOCK_PROFILE_SITES && s->sites[i].site; i++) {
+      lock_site* ls = &s->sites[i];
+      int j = ntop < LOCK_PROFILE_TOP ? ntop++ : LOCK_PROFILE_TOP;
+      for (; j > 0 && top[j - 1].site->spins < ls->spins; j--)
+        if (j < LOCK_PROFILE_TOP) top[j] = top[j - 1];
+      if (j < LOCK_PROFILE_TOP) {
+        top[j].lock = l;
+        top[j].site = ls;
+      }
+    }
+  }
+
+  sprint("most contended call sites (contended, spins):\n");
+  for (int i = 0; i < ntop; i++)
+    sprint("  %s at %s: %ld, %ld\n", top[i].lock->name ? top[i].lock->name : "(unnamed)",
+      top[i].site->site, top[i].site->contended, top[i].site->spins);
+}
+
+#else
+
+void lock_stat_acquired(spinlock_t* lock, const char* site, unsigned long spins) {}
+
+void lock_stat_released(spinlock_t* lock) {}
+
+void lock_stat_print(void) { sprint("lock profiling is off, see LOCK_PROFILE.\n"); }
+
+#endif
@@ -12,12 +12,24 @@
 #include "string.h"
 #include "util/functions.h"
 #include "spike_interface/spike_utils.h"
+#include "kernel/slab.h"
 //#include "../kernel/config.h"
 
-#define MAX_FILES 128
 #define MAX_FDS 128
 static spike_file_t* spike_fds[MAX_FDS];
-spike_file_t spike_files[MAX_FILES] = {[0 ... MAX_FILES - 1] = {-1, 0}};
+// stdin, stdout and stderr. they are set up before the page allocator, the files opened
+// later come from spike_file_cache.
+#define NR_STDIO_FILES 3
+spike_file_t spike_files[NR_STDIO_FILES] = {[0 ... NR_STDIO_FILES - 1] = {-1, 0}};
+
+static void spike_file_ctor(void* obj) {
+  spike_file_t* f = (spike_file_t*)obj;
+  f->kfd = -1;
+  f->refcnt = 0;
+}
+
+static kmem_cache spike_file_cache =
+    KMEM_CACHE_INIT("spike_file_t", sizeof(spike_file_t), spike_file_ctor);
 
 void copy_stat(struct stat* dest_va, struct frontend_stat* src) {
   struct stat* dest = (struct stat*)dest_va;
@@ -46,11 +58,11 @@ int spike_file_stat(spike_file_t* f, struct stat* s) {
 
 int spike_file_close(spike_file_t* f) {
   if (!f) return -1;
+  // the reference of the fd slot, if f is installed in one, and the one of the opener
   spike_file_t* old = atomic_cas(&spike_fds[f->kfd], f, 0);
   spike_file_decref(f);
-  if (old != f) return -1;
   spike_file_decref(f);
-  return 0;
+  return old == f ? 0 : -1;
 }
 
 void spike_file_decref(spike_file_t* f) {
@@ -60,6 +72,11 @@ void spike_file_decref(spike_file_t* f) {
     atomic_set(&f->refcnt, 0);
 
     frontend_syscall(HTIFSYS_close, kfd, 0, 0, 0, 0, 0, 0);
+    // back to the cache in constructed state
+    if (f < spike_files || f >= spike_files + NR_STDIO_FILES) {
+      f->kfd = -1;
+      kmem_cache_free(&spike_file_cache, f);
+    }
   }
 }
 
@@ -73,10 +90,9 @@ ssize_t spike_file_write(spike_file_t* f, const void* buf, size_t size) {
 }
 
 static spike_file_t* spike_file_get_free(void) {
-  for (spike_file_t* f = spike_files; f < spike_files + MAX_FILES; f++)
-    if (atomic_read(&f->refcnt) == 0 && atomic_cas(&f->refcnt, 0, INIT_FILE_REF) == 0)
-      return f;
-  return NULL;
+  spike_file_t* f = (spike_file_t*)kmem_cache_alloc(&spike_file_cache);
+  if (f) atomic_set(&f->refcnt, INIT_FILE_REF);
+  return f;
 }
 
 int spike_file_dup(spike_file_t* f) {
@@ -91,8 +107,9 @@ int spike_file_dup(spike_file_t* f) {
 
 void spike_file_init(void) {
   // create stdin, stdout, stderr and FDs 0-2
-  for (int i = 0; i < 3; i++) {
-    spike_file_t* f = spike_file_get_free();
+  for (int i = 0; i < NR_STDIO_FILES; i++) {
+    spike_file_t* f = &spike_files[i];
+    atomic_set(&f->refcnt, INIT_FILE_REF);
     f->kfd = i;
     spike_file_dup(f);
   }
@@ -128,3 +145,91 @@ ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size) {
 ssize_t spike_file_lseek(spike_file_t* f, size_t ptr, int dir) {
   return frontend_syscall(HTIFSYS_lseek, f->kfd, ptr, dir, 0, 0, 0, 0);
 }
+
+//===============    buffered line reading of host files    ===============
+// the readers are shared by the harts, which may report faults at the same time.
+// line_files_lock guards the readers and their buffers.
+static spike_line_file_t line_files[SPIKE_LINE_FILES];
+static int line_files_next;
+static spinlock_t line_files_lock = SPINLOCK_INIT_NAMED("line_files");
+
+//
+// returns the cached reader of path, opening (and evicting the oldest reader) on a miss.
+//
+static spike_line_file_t* line_file_get(const char* path) {
+  for (int i = 0; i < SPIKE_LINE_FILES; i++)
+    if (line_files[i].f && !strcmp(line_files[i].path, path)) return &line_files[i];
+
+  if (strlen(path) >= sizeof(line_files[0].path)) return NULL;
+  spike_file_t* f = spike_file_open(path, O_RDONLY, 0);
+  if (IS_ERR_VALUE(f)) return NULL;
+
+  spike_line_file_t* lf = &line_files[line_files_next];
+  line_files_next = (line_files_next + 1) % SPIKE_LINE_FILES;
+  if (lf->f) spike_file_close(lf->f);
+
+  strcpy(lf->path, path);
+  lf->f = f;
+  lf->buf_off = lf->buf_len = 0;
+  lf->line_off[0] = 0;
+  lf->nindex = 1;
+  return lf;
+}
+
+//
+// returns the byte at offset off, or -1 beyond the end of file. a miss refills the
+// whole buffer with one pread.
+//
+static int line_file_byte(spike_line_file_t* lf, uint64 off) {
+  if (off < lf->buf_off || off >= lf->buf_off + lf->buf_len) {
+    lf->buf_off = off;
+    ssize_t r = spike_file_pread(lf->f, lf->buf, SPIKE_LINE_BUF_SIZE, off);
+    lf->buf_len = r > 0 ? r : 0;
+    if (!lf->buf_len) return -1;
+  }
+  return (uint8)lf->buf[off - lf->buf_off];
+}
+
+//
+// copy line lineno of the host file path into buf, with line_files_lock held.
+//
+static int line_file_getline(const char* path, int lineno, char* buf, int n) {
+  spike_line_file_t* lf = line_file_get(path);
+  if (!lf || lineno < 1 || n < 1) return -1;
+
+  // start from the closest indexed line at or before lineno
+  int k = MIN((lineno - 1) / SPIKE_LINE_INDEX_STEP, lf->nindex - 1);
+  int line = k * SPIKE_LINE_INDEX_STEP + 1;
+  uint64 off = lf->line_off[k];
+  int c;
+
+  while (line < lineno) {
+    while ((c = line_file_byte(lf, off)) >= 0 && c != '\n') off++;
+    if (c < 0) return -1;
+    off++; line++;
+    // extend the index with the start of this line if it is the next one to record
+    if ((line - 1) % SPIKE_LINE_INDEX_STEP == 0 && (line - 1) / SPIKE_LINE_INDEX_STEP == lf->nindex &&
+        lf->nindex < SPIKE_LINE_INDEX_SIZE)
+      lf->line_off[lf->nindex++] = off;
+  }
+
+  int len = 0;
+  while ((c = line_file_byte(lf, off + len)) >= 0 && c != '\n') {
+    if (len < n - 1) buf[len] = c;
+    len++;
+  }
+  if (c < 0 && len == 0) return -1;
+  buf[MIN(len, n - 1)] = 0;
+  return MIN(len, n - 1);
+}
+
+//
+// copy line lineno (counted from 1, without the newline) of the host file path into buf.
+// returns the length of the line, or -1 if the file or the line does not exist.
+//
+int spike_file_getline(const char* path, int lineno, char* buf, int n) {
+  spinlock_lock(&line_files_lock);
+  int len = line_file_getline(path, lineno, buf, n);
+  spinlock_unlock(&line_files_lock);
+  return len;
+}
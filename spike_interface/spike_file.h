@@ -47,6 +47,25 @@ struct frontend_stat {
   uint32 __unused5;
 };
 
+// buffered line reader over host (source) files, used to print the faulting source line.
+// the start offset of every SPIKE_LINE_INDEX_STEP-th line is remembered, so that
+// reaching a line only scans from the closest indexed line before it.
+#define SPIKE_LINE_FILES 4
+#define SPIKE_LINE_BUF_SIZE 4096
+#define SPIKE_LINE_INDEX_STEP 16
+#define SPIKE_LINE_INDEX_SIZE 1024
+
+typedef struct line_file_t {
+  char path[256];
+  spike_file_t* f;
+  // file contents cached from offset buf_off, buf_len bytes valid
+  char buf[SPIKE_LINE_BUF_SIZE];
+  uint64 buf_off, buf_len;
+  // line_off[i] is the offset of line i * SPIKE_LINE_INDEX_STEP + 1
+  uint64 line_off[SPIKE_LINE_INDEX_SIZE];
+  int nindex;
+} spike_line_file_t;
+
 void copy_stat(struct stat* dest, struct frontend_stat* src);
 spike_file_t* spike_file_open(const char* fn, int flags, int mode);
 int spike_file_close(spike_file_t* f);
@@ -56,9 +75,11 @@ ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size);
 ssize_t spike_file_pread(spike_file_t* f, void* buf, size_t n, off_t off);
 ssize_t spike_file_write(spike_file_t* f, const void* buf, size_t n);
 void spike_file_decref(spike_file_t* f);
+void spike_file_incref(spike_file_t* f);
 void spike_file_init(void);
 int spike_file_dup(spike_file_t* f);
 int spike_file_truncate(spike_file_t* f, off_t len);
 int spike_file_stat(spike_file_t* f, struct stat* s);
+int spike_file_getline(const char* path, int lineno, char* buf, int n);
 
 #endif
@@ -70,7 +70,7 @@ extern uint64_t __htif_base;
 #define FROMHOST_OFFSET ((uint64)fromhost - (uint64)__htif_base)
 
 volatile int htif_console_buf;
-static spinlock_t htif_lock = SPINLOCK_INIT;
+static spinlock_t htif_lock = SPINLOCK_INIT_NAMED("htif");
 
 static void __check_fromhost(void) {
   uint64_t fh = fromhost;
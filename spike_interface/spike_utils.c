@@ -16,7 +16,7 @@ long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64
       uint64 a5, uint64 a6) {
   static volatile uint64 magic_mem[8];
 
-  static spinlock_t lock = SPINLOCK_INIT;
+  static spinlock_t lock = SPINLOCK_INIT_NAMED("frontend_syscall");
   spinlock_lock(&lock);
 
   magic_mem[0] = n;
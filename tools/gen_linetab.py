@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+#
+# generate the line table sidecar of a user application: the address-to-line table of
+# its .debug_line section, decoded, sorted and encoded in exactly the in-memory layout
+# used by kernel/debug_info.c, so that PKE loads it with a single pread instead of
+# running the DWARF line programs at runtime.
+#
+# usage: gen_linetab.py <elf> <sidecar>
+#
+# layout (little endian, see linetab_header in kernel/elf.h):
+#   header
+#   ndir  x uint64              directory names (offsets into the string pool)
+#   nfile x {uint64, uint64}    directory index, file name (offset into the pool)
+#   index + delta-encoded rows  as built by encode_line_table()
+#   string pool
+#
+
+import struct
+import sys
+
+LINETAB_MAGIC = 0x4c544b50  # "PKTL"
+LINETAB_VERSION = 2
+LINE_BLOCK_ROWS = 32  # must match kernel/process.h
+
+
+# mirrors linetab_hash() in kernel/elf.c: 64-bit FNV-1a
+def fnv1a(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & (2**64 - 1)
+    return h
+
+
+def sections(elf):
+    if elf[:4] != b"\x7fELF" or elf[4] != 2 or elf[5] != 1:
+        sys.exit("%s: not a little-endian ELF64 file" % sys.argv[1])
+    shoff, = struct.unpack_from("<Q", elf, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3a)
+    hdrs = [struct.unpack_from("<IIQQQQIIQQ", elf, shoff + i * shentsize) for i in range(shnum)]
+    strtab = hdrs[shstrndx][4]
+    res = {}
+    for h in hdrs:
+        name = elf[strtab + h[0]:elf.index(b"\0", strtab + h[0])].decode()
+        res[name] = elf[h[4]:h[4] + h[5]]
+    return res
+
+
+def uleb(data, off):
+    value = shift = 0
+    while True:
+        b = data[off]
+        off += 1
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, off
+
+
+def sleb(data, off):
+    value = shift = 0
+    while True:
+        b = data[off]
+        off += 1
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            break
+    if b & 0x40:
+        value -= 1 << shift
+    return value, off
+
+
+def cstr(data, off):
+    end = data.index(b"\0", off)
+    return data[off:end], end + 1
+
+
+# mirrors decode_line_programs() in kernel/elf.c
+def decode(dl):
+    dirs, files, rows = [], [], []
+    off = 0
+    while off < len(dl):
+        length, = struct.unpack_from("<I", dl, off)
+        cu_end = off + 4 + length
+        version, hlen, min_inst, is_stmt, line_base, line_range, opcode_base = \
+            struct.unpack_from("<HIBBbBB", dl, off + 4)
+        if version > 3:
+            sys.exit("%s: DWARF line table version %d not supported" % (sys.argv[1], version))
+        off += 4 + 2 + 4 + 5 + 12
+        dir_base, file_base = len(dirs), len(files)
+        while dl[off]:
+            d, off = cstr(dl, off)
+            dirs.append(d)
+        off += 1
+        while dl[off]:
+            f, off = cstr(dl, off)
+            d, off = uleb(dl, off)
+            _, off = uleb(dl, off)
+            _, off = uleb(dl, off)
+            files.append((d - 1 + dir_base, f))
+        off += 1
+
+        def add(addr, line, file):
+            if rows and rows[-1][0] == addr:
+                rows.pop()
+            rows.append((addr, line, file + file_base - 1))
+
+        addr, file, line = 0, 1, 1
+        while off < cu_end:
+            op = dl[off]
+            off += 1
+            if op == 0:
+                _, off = uleb(dl, off)
+                op = dl[off]
+                off += 1
+                if op == 1:
+                    add(addr, 0, file)
+                    addr, file, line = 0, 1, 1
+                elif op == 2:
+                    addr, = struct.unpack_from("<Q", dl, off)
+                    off += 8
+                elif op == 4:
+                    _, off = uleb(dl, off)
+            elif op == 1:
+                add(addr, line, file)
+            elif op == 2:
+                d, off = uleb(dl, off)
+                addr += d * min_inst
+            elif op == 3:
+                d, off = sleb(dl, off)
+                line += d
+            elif op == 4:
+                file, off = uleb(dl, off)
+            elif op == 5:
+                _, off = uleb(dl, off)
+            elif op in (6, 7):
+                pass
+            elif op == 8:
+                addr += ((255 - opcode_base) // line_range) * min_inst
+            elif op == 9:
+                d, = struct.unpack_from("<H", dl, off)
+                off += 2
+                addr += d
+            else:
+                adjust = op - opcode_base
+                addr += (adjust // line_range) * min_inst
+                line += line_base + adjust % line_range
+                add(addr, line, file)
+        off = cu_end
+    return dirs, files, rows
+
+
+def put_uleb(out, value):
+    while True:
+        b = value & 0x7f
+        value >>= 7
+        out.append(b | (0x80 if value else 0))
+        if not value:
+            return
+
+
+def put_sleb(out, value):
+    while True:
+        b = value & 0x7f
+        value >>= 7
+        if (value == 0 and not b & 0x40) or (value == -1 and b & 0x40):
+            out.append(b)
+            return
+        out.append(b | 0x80)
+
+
+# mirrors encode_line_table() in kernel/debug_info.c
+def encode(rows):
+    index, data = bytearray(), bytearray()
+    for i, (addr, line, file) in enumerate(rows):
+        if i % LINE_BLOCK_ROWS == 0:
+            index += struct.pack("<QIIIxxxx", addr, line, file, len(data))
+            continue
+        prev = rows[i - 1]
+        put_uleb(data, addr - prev[0])
+        put_sleb(data, line - prev[1])
+        put_sleb(data, file - prev[2])
+    return index + data
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: %s <elf> <sidecar>" % sys.argv[0])
+    with open(sys.argv[1], "rb") as f:
+        secs = sections(f.read())
+    dl = secs.get(".debug_line", b"")
+    dirs, files, rows = decode(dl)
+    # end-of-sequence rows sort before rows starting at the same address
+    rows.sort(key=lambda r: (r[0], r[1] != 0))
+
+    pool = bytearray()
+
+    def intern(s):
+        pos = len(pool)
+        pool.extend(s + b"\0")
+        return pos
+
+    dir_tab = b"".join(struct.pack("<Q", intern(d)) for d in dirs)
+    file_tab = b"".join(struct.pack("<QQ", d & (2**64 - 1), intern(f)) for d, f in files)
+    table = encode(rows)
+    nblocks = (len(rows) + LINE_BLOCK_ROWS - 1) // LINE_BLOCK_ROWS
+    header = struct.pack("<IIQQQQQQQQ", LINETAB_MAGIC, LINETAB_VERSION, len(dl), fnv1a(dl),
+                         len(rows), nblocks, len(dirs), len(files), len(table), len(pool))
+    with open(sys.argv[2], "wb") as f:
+        f.write(header + dir_tab + file_tab + table + pool)
+
+
+if __name__ == "__main__":
+    main()
@@ -10,15 +10,15 @@
 #include "util/snprintf.h"
 #include "kernel/syscall.h"
 
-int do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5, uint64 a6,
-                 uint64 a7) {
-  int ret;
+long do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5, uint64 a6,
+                  uint64 a7) {
+  long ret;
 
   // before invoking the syscall, arguments of do_user_call are already loaded into the argument
   // registers (a0-a7) of our (emulated) risc-v machine.
   asm volatile(
       "ecall\n"
-      "sw a0, %0"  // returns a 32-bit value
+      "sd a0, %0"  // returns a 64-bit value, addresses included
       : "=m"(ret)
       :
       : "memory");
@@ -37,7 +37,7 @@ int printu(const char* s, ...) {
   int res = vsnprintf(out, sizeof(out), s, vl);
   va_end(vl);
   const char* buf = out;
-  size_t n = res < sizeof(out) ? res : sizeof(out);
+  size_t n = res < sizeof(out) ? res : sizeof(out) - 1;  // without the terminating 0
 
   // make a syscall to implement the required functionality.
   return do_user_call(SYS_user_print, (uint64)buf, n, 0, 0, 0, 0, 0);
@@ -49,3 +49,179 @@ int printu(const char* s, ...) {
 int exit(int code) {
   return do_user_call(SYS_user_exit, code, 0, 0, 0, 0, 0, 0); 
 }
+
+//
+// move the program break by increment bytes, returns the previous break or (void *)-1.
+//
+void* sbrk(long increment) {
+  return (void*)do_user_call(SYS_user_sbrk, increment, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// map length bytes of zero-filled memory, returns its address or MAP_FAILED.
+//
+void* mmap(void* addr, size_t length, int prot) {
+  return (void*)do_user_call(SYS_user_mmap, (uint64)addr, length, prot, 0, 0, 0, 0);
+}
+
+int munmap(void* addr, size_t length) {
+  return do_user_call(SYS_user_munmap, (uint64)addr, length, 0, 0, 0, 0, 0);
+}
+
+//
+// create a child process sharing the memory of the caller copy-on-write. returns the pid
+// of the child to the parent, 0 to the child, or -1.
+//
+int fork() {
+  return do_user_call(SYS_user_fork, 0, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// give up the processor to the next ready process.
+//
+void yield() {
+  do_user_call(SYS_user_yield, 0, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// print the spinlock contention profile of the kernel, if it is built with LOCK_PROFILE.
+//
+void lock_stats() {
+  do_user_call(SYS_user_lock_stats, 0, 0, 0, 0, 0, 0, 0);
+}
+
+// user-space malloc. requests of up to MALLOC_MAX_SMALL bytes are served from the free
+// list of their size class, refilled a run at a time from an arena bump-allocated out of
+// the sbrk heap, so most calls never enter the kernel. larger requests get pages of their
+// own from mmap.
+
+// size classes of small objects, in bytes
+static const uint32 size_classes[] = {16,  32,  48,  64,  96,   128,  192,
+                                      256, 384, 512, 768, 1024, 1536, 2048};
+#define NR_SIZE_CLASSES (sizeof(size_classes) / sizeof(size_classes[0]))
+#define MALLOC_MAX_SMALL 2048
+
+// objects of a class are carved from runs of MALLOC_RUN_SIZE bytes, aligned to their size
+// and starting with a header naming the class. the arena grows MALLOC_ARENA_GROW bytes
+// at a time.
+#define MALLOC_RUN_SIZE 16384
+#define MALLOC_ARENA_GROW (16 * MALLOC_RUN_SIZE)
+// header of a run, and of a large object, keeping objects 16-byte aligned
+#define MALLOC_HDR 16
+
+typedef struct free_obj_t {
+  struct free_obj_t* next;
+} free_obj;
+
+// per size class free lists
+static free_obj* free_lists[NR_SIZE_CLASSES];
+// size class of each 16-byte granule of a small request, built on first use
+static uint8 class_of[MALLOC_MAX_SMALL / 16 + 1];
+static int class_of_ready;
+// the arena: [arena_cur, arena_end) is not carved yet. every small object lies below
+// arena_hi, every large one above it, as the sbrk heap is below the mmap area.
+static char *arena_cur, *arena_end, *arena_hi;
+static malloc_stats stats;
+
+//
+// extend the arena by MALLOC_ARENA_GROW bytes, aligned to MALLOC_RUN_SIZE.
+//
+static int arena_grow(void) {
+  char* brk = (char*)sbrk(0);
+  uint64 pad = -(uint64)brk & (MALLOC_RUN_SIZE - 1);
+  char* mem = (char*)sbrk(pad + MALLOC_ARENA_GROW);
+  stats.syscalls += 2;
+  if (mem == (char*)-1) return -1;
+
+  // the remains of the old arena are dropped if the heap was moved by someone else
+  if (mem != arena_end || pad) arena_cur = mem + pad;
+  arena_end = arena_hi = mem + pad + MALLOC_ARENA_GROW;
+  stats.arena_bytes += pad + MALLOC_ARENA_GROW;
+  return 0;
+}
+
+//
+// carve a run of the arena into free objects of size class cls.
+//
+static int refill(int cls) {
+  if (arena_end - arena_cur < MALLOC_RUN_SIZE && arena_grow() != 0) return -1;
+
+  char* run = arena_cur;
+  arena_cur += MALLOC_RUN_SIZE;
+  *(uint64*)run = cls;
+  stats.runs++;
+
+  // link the objects in address order
+  uint32 size = size_classes[cls];
+  uint64 n = (MALLOC_RUN_SIZE - MALLOC_HDR) / size;
+  for (uint64 i = n; i > 0; i--) {
+    free_obj* obj = (free_obj*)(run + MALLOC_HDR + (i - 1) * size);
+    obj->next = free_lists[cls];
+    free_lists[cls] = obj;
+  }
+  return 0;
+}
+
+static void* malloc_large(size_t n) {
+  uint64 size = (n + MALLOC_HDR + 4095) & ~4095ULL;
+  char* mem = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE);
+  stats.syscalls++;
+  if (mem == (char*)MAP_FAILED) return NULL;
+
+  *(uint64*)mem = size;
+  stats.large_allocs++;
+  stats.large_bytes += size;
+  return mem + MALLOC_HDR;
+}
+
+//
+// allocate n bytes, 16-byte aligned. returns NULL if memory is out.
+//
+void* malloc(size_t n) {
+  if (n > MALLOC_MAX_SMALL) return malloc_large(n);
+
+  if (!class_of_ready) {
+    int cls = 0;
+    for (int g = 0; g <= MALLOC_MAX_SMALL / 16; g++) {
+      while (size_classes[cls] < g * 16) cls++;
+      class_of[g] = cls;
+    }
+    class_of_ready = 1;
+  }
+  int cls = class_of[(n + 15) / 16];
+
+  if (!free_lists[cls] && refill(cls) != 0) return NULL;
+  free_obj* obj = free_lists[cls];
+  free_lists[cls] = obj->next;
+  stats.small_allocs++;
+  return obj;
+}
+
+//
+// return the memory at ptr, got from malloc(). a small object goes back to the free list
+// of its class, found in the header of its run. a large one is unmapped.
+//
+void free(void* ptr) {
+  if (!ptr) return;
+
+  if ((char*)ptr < arena_hi) {
+    char* run = (char*)((uint64)ptr & ~(uint64)(MALLOC_RUN_SIZE - 1));
+    int cls = *(uint64*)run;
+    free_obj* obj = (free_obj*)ptr;
+    obj->next = free_lists[cls];
+    free_lists[cls] = obj;
+    stats.small_frees++;
+  } else {
+    char* mem = (char*)ptr - MALLOC_HDR;
+    uint64 size = *(uint64*)mem;
+    stats.large_frees++;
+    stats.large_bytes -= size;
+    stats.syscalls++;
+    munmap(mem, size);
+  }
+}
+
+//
+// copy the allocator statistics to st.
+//
+void malloc_get_stats(malloc_stats* st) { *st = stats; }
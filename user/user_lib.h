@@ -2,5 +2,33 @@
  * header file to be used by applications.
  */
 
+#include "util/types.h"
+
+// permissions of mmap()
+#define PROT_NONE 0
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+#define MAP_FAILED ((void *)-1)
+
+// statistics of malloc()
+typedef struct malloc_stats_t {
+  uint64 small_allocs, small_frees;  // requests served from the size classes
+  uint64 large_allocs, large_frees;  // requests served by mmap
+  uint64 arena_bytes;                // bytes of the arena taken from the sbrk heap
+  uint64 runs;                       // runs of the arena carved into objects
+  uint64 large_bytes;                // bytes mapped by large objects in use
+  uint64 syscalls;                   // sbrk, mmap and munmap calls made
+} malloc_stats;
+
 int printu(const char *s, ...);
 int exit(int code);
+void *sbrk(long increment);
+void *mmap(void *addr, size_t length, int prot);
+int munmap(void *addr, size_t length);
+int fork();
+void yield();
+void lock_stats();
+void *malloc(size_t n);
+void free(void *ptr);
+void malloc_get_stats(malloc_stats *st);
@@ -38,6 +38,27 @@ void* memset(void* dest, int byte, size_t len) {
   return dest;
 }
 
+// zero a (possibly unaligned) block: byte stores up to the first word boundary, then
+// unrolled 8-word stores, then the remaining words and bytes.
+void* memzero(void* dest, size_t len) {
+  char* d = dest;
+  char* end = d + len;
+
+  while (d < end && ((uintptr_t)d & (sizeof(uintptr_t) - 1))) *d++ = 0;
+
+  uintptr_t* w = (uintptr_t*)d;
+  while ((char*)(w + 8) <= end) {
+    w[0] = 0; w[1] = 0; w[2] = 0; w[3] = 0;
+    w[4] = 0; w[5] = 0; w[6] = 0; w[7] = 0;
+    w += 8;
+  }
+  while ((char*)(w + 1) <= end) *w++ = 0;
+
+  d = (char*)w;
+  while (d < end) *d++ = 0;
+  return dest;
+}
+
 size_t strlen(const char* s) {
   const char* p = s;
   while (*p) p++;